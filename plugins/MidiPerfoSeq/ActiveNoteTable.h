@@ -0,0 +1,73 @@
+#ifndef MIDI_PERFOSEQ_ACTIVE_NOTE_TABLE_INCLUDED
+#define MIDI_PERFOSEQ_ACTIVE_NOTE_TABLE_INCLUDED
+
+#include <cstdint>
+
+/*
+ * Which notes the plugin has switched on at its output:
+ * one 128 bit set per midi channel plus a mask of channels with sounding notes.
+ * Setting, clearing and testing are O(1), releasing everything only visits
+ * the notes which are actually sounding.
+ */
+class ActiveNoteTable
+{
+public:
+    ActiveNoteTable() { clear(); }
+
+    void clear()
+    {
+        for (int c=0;c<16;c++) bits[c][0] = bits[c][1] = 0;
+        channelMask = 0;
+    }
+
+    bool empty() const { return channelMask == 0; }
+
+    bool isOn(uint8_t channel, uint8_t note) const
+    {
+        return (bits[channel & 0x0F][(note >> 6) & 1] >> (note & 63)) & 1;
+    }
+
+    void noteOn(uint8_t channel, uint8_t note)
+    {
+        channel &= 0x0F;
+        bits[channel][(note >> 6) & 1] |= uint64_t(1) << (note & 63);
+        channelMask |= uint16_t(1u << channel);
+    }
+
+    void noteOff(uint8_t channel, uint8_t note)
+    {
+        channel &= 0x0F;
+        bits[channel][(note >> 6) & 1] &= ~(uint64_t(1) << (note & 63));
+        if ((bits[channel][0] | bits[channel][1]) == 0) channelMask &= uint16_t(~(1u << channel));
+    }
+
+    /*
+     * Calls release(channel, note) for every sounding note and clears the table.
+     */
+    template <class Release>
+    void releaseAll(Release release)
+    {
+        while (channelMask)
+        {
+            const int channel = __builtin_ctz(channelMask);
+            for (int half=0;half<2;half++)
+            {
+                uint64_t word = bits[channel][half];
+                while (word)
+                {
+                    const int bit = __builtin_ctzll(word);
+                    release(uint8_t(channel), uint8_t(half * 64 + bit));
+                    word &= word - 1;
+                }
+                bits[channel][half] = 0;
+            }
+            channelMask &= uint16_t(~(1u << channel));
+        }
+    }
+
+private:
+    uint64_t bits[16][2];
+    uint16_t channelMask;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef MIDI_PERFOSEQ_BLOCK_STATS_INCLUDED
+#define MIDI_PERFOSEQ_BLOCK_STATS_INCLUDED
+
+#include "DistrhoPlugin.hpp"
+#include <cstdint>
+
+/*
+ * Processing time statistics of run() (build option MIDIPERFOSEQ_BLOCK_STATS).
+ * Block times go into a histogram with 8 sub buckets per power of two (~9% resolution),
+ * so recording is a few instructions without allocation and percentiles can be
+ * read out later on a non realtime thread.
+ */
+class BlockStats
+{
+public:
+    BlockStats() { reset(); }
+
+    void reset()
+    {
+        for (int i=0;i<kBuckets;i++) histogram[i] = 0;
+        blocks = 0;
+        events = 0;
+        frames = 0;
+        totalNs = 0;
+        maxNs = 0;
+    }
+
+    void add(uint64_t ns, uint32_t blockEvents, uint32_t blockFrames)
+    {
+        histogram[bucketOf(ns)] += 1;
+        blocks += 1;
+        events += blockEvents;
+        frames += blockFrames;
+        totalNs += ns;
+        if (ns > maxNs) maxNs = ns;
+    }
+
+    uint64_t count() const { return blocks; }
+
+    // upper bound of the bucket holding the given fraction of all blocks
+    uint64_t percentile(double fraction) const
+    {
+        const uint64_t wanted = uint64_t(fraction * double(blocks));
+        uint64_t seen = 0;
+        for (int i=0;i<kBuckets;i++)
+        {
+            seen += histogram[i];
+            if (seen > wanted) return bucketLimit(i);
+        }
+        return maxNs;
+    }
+
+    /*
+     * Prints one line, e.g. on deactivation. Not realtime safe.
+     */
+    void report(const char* name) const
+    {
+        if (blocks == 0) return;
+        d_stdout("%s: %llu blocks, %.1f frames/block, %.0f events/s processed, %.0f ns/block mean, "
+                 "p50 %llu ns, p99 %llu ns, max %llu ns",
+                 name, (unsigned long long)blocks, double(frames) / double(blocks),
+                 totalNs ? double(events) * 1e9 / double(totalNs) : 0.0,
+                 double(totalNs) / double(blocks),
+                 (unsigned long long)percentile(0.5), (unsigned long long)percentile(0.99),
+                 (unsigned long long)maxNs);
+    }
+
+private:
+    static const int kSubBits = 3;
+    static const int kBuckets = 64 << kSubBits;
+
+    static int bucketOf(uint64_t ns)
+    {
+        if (ns < (1u << kSubBits)) return int(ns);
+        const int exponent = 63 - __builtin_clzll(ns);
+        const int sub = int((ns >> (exponent - kSubBits)) & ((1 << kSubBits) - 1));
+        return ((exponent - kSubBits + 1) << kSubBits) + sub;
+    }
+
+    static uint64_t bucketLimit(int bucket)
+    {
+        if (bucket < (1 << kSubBits)) return uint64_t(bucket);
+        const int exponent = (bucket >> kSubBits) + kSubBits - 1;
+        const uint64_t sub = uint64_t(bucket & ((1 << kSubBits) - 1));
+        return ((uint64_t(1) << kSubBits | sub) + 1) << (exponent - kSubBits);
+    }
+
+    uint32_t histogram[kBuckets];
+    uint64_t blocks;
+    uint64_t events;
+    uint64_t frames;
+    uint64_t totalNs;
+    uint64_t maxNs;
+};
+
+#endif
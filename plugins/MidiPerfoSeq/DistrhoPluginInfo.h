@@ -30,5 +30,8 @@
 #define DISTRHO_PLUGIN_NUM_OUTPUTS      0
 #define DISTRHO_PLUGIN_WANT_MIDI_INPUT  1
 #define DISTRHO_PLUGIN_WANT_MIDI_OUTPUT 1
+#define DISTRHO_PLUGIN_WANT_TIMEPOS     1
+#define DISTRHO_PLUGIN_WANT_STATE       1
+#define DISTRHO_PLUGIN_WANT_FULL_STATE  1
 
 #endif // DISTRHO_PLUGIN_INFO_H_INCLUDED
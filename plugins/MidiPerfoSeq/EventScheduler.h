@@ -0,0 +1,86 @@
+#ifndef MIDI_PERFOSEQ_EVENT_SCHEDULER_INCLUDED
+#define MIDI_PERFOSEQ_EVENT_SCHEDULER_INCLUDED
+
+#include <cstdint>
+
+const int MAX_SCHEDULED_EVENTS = 1024;
+
+/*
+ * A short midi message to be sent at an absolute frame time (frames since activation).
+ */
+struct ScheduledEvent {
+    uint64_t time;
+    uint32_t sequence;  // keeps events with equal times in insertion order
+    uint8_t data[3];
+    uint8_t size;
+};
+
+/*
+ * Fixed capacity priority queue (binary min heap) of pending midi messages.
+ * Used for events that belong to a later frame or a later block, e.g. note offs
+ * at the end of a gate. Push and pop are O(log n), nothing is allocated.
+ */
+class EventScheduler
+{
+public:
+    EventScheduler() : count(0), sequence(0) {}
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() { count = 0; }
+
+    // time of the next pending event, only valid when not empty
+    uint64_t nextTime() const { return heap[0].time; }
+    const ScheduledEvent& top() const { return heap[0]; }
+
+    // returns false when the queue is full, the caller has to send the event right away
+    bool push(uint64_t time, const uint8_t* data, uint8_t size)
+    {
+        if (count >= MAX_SCHEDULED_EVENTS) return false;
+        ScheduledEvent event;
+        event.time = time;
+        event.sequence = sequence++;
+        event.size = size;
+        for (int i=0;i<3;i++) event.data[i] = i < size ? data[i] : 0;
+        int child = count++;
+        while (child > 0)
+        {
+            const int parent = (child - 1) / 2;
+            if (!before(event, heap[parent])) break;
+            heap[child] = heap[parent];
+            child = parent;
+        }
+        heap[child] = event;
+        return true;
+    }
+
+    void pop()
+    {
+        if (count == 0) return;
+        const ScheduledEvent last = heap[--count];
+        int parent = 0;
+        for (;;)
+        {
+            int child = 2 * parent + 1;
+            if (child >= count) break;
+            if (child + 1 < count && before(heap[child+1], heap[child])) child += 1;
+            if (!before(heap[child], last)) break;
+            heap[parent] = heap[child];
+            parent = child;
+        }
+        if (count > 0) heap[parent] = last;
+    }
+
+private:
+    static bool before(const ScheduledEvent& a, const ScheduledEvent& b)
+    {
+        if (a.time != b.time) return a.time < b.time;
+        return int32_t(a.sequence - b.sequence) < 0;
+    }
+
+    ScheduledEvent heap[MAX_SCHEDULED_EVENTS];
+    int count;
+    uint32_t sequence;
+};
+
+#endif
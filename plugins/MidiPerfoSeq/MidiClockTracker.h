@@ -0,0 +1,81 @@
+#ifndef MIDI_PERFOSEQ_MIDI_CLOCK_TRACKER_INCLUDED
+#define MIDI_PERFOSEQ_MIDI_CLOCK_TRACKER_INCLUDED
+
+#include <cmath>
+#include <cstdint>
+
+const int MIDI_CLOCKS_PER_QUARTER = 24;
+
+/*
+ * Smooths the arrival times of midi clock bytes (0xF8) with a second order
+ * delay locked loop. Every clock costs a few multiplications, the loop follows
+ * tempo changes within about a second and filters the jitter of the transport
+ * (USB midi delivers its bytes in 1 ms frames).
+ * Times are frames since activation. A clock far off the prediction, after a pause
+ * or a jump of the tempo, locks the loop again from the measured interval.
+ */
+class MidiClockTracker
+{
+public:
+    MidiClockTracker() : sampleRate(48000.0), period(0.0), predicted(0.0), lastTime(0.0), clocks(0) {}
+
+    void reset(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+        clocks = 0;
+    }
+
+    bool locked() const { return clocks >= 2; }
+
+    // frames per clock, valid when locked
+    double framesPerClock() const { return period; }
+
+    /*
+     * A clock arrived at the given time. Returns the smoothed time of this clock,
+     * nominalPeriod is assumed until the second clock gives the first interval.
+     */
+    double clock(uint64_t time, double nominalPeriod)
+    {
+        const double t = double(time);
+        if (clocks > 0)
+        {
+            const double error = t - predicted;
+            if (clocks >= 2 && std::fabs(error) < 0.5 * period)
+            {
+                // loop bandwidth of 1 Hz, critically damped
+                const double omega = 2.0 * 3.14159265358979 * period / sampleRate;
+                const double smoothed = predicted;
+                predicted += std::sqrt(2.0) * omega * error + period;
+                period += omega * omega * error;
+                lastTime = t;
+                clocks += 1;
+                return smoothed;
+            }
+            // lost or just started: take the measured interval if it is a plausible tempo (15-600 bpm)
+            const double interval = t - lastTime;
+            if (interval >= sampleRate * 60.0 / (600.0 * MIDI_CLOCKS_PER_QUARTER)
+                && interval <= sampleRate * 60.0 / (15.0 * MIDI_CLOCKS_PER_QUARTER))
+            {
+                period = interval;
+                predicted = t + period;
+                lastTime = t;
+                clocks = 2;
+                return t;
+            }
+        }
+        period = nominalPeriod;
+        predicted = t + period;
+        lastTime = t;
+        clocks = 1;
+        return t;
+    }
+
+private:
+    double sampleRate;
+    double period;     // frames per clock
+    double predicted;  // expected time of the next clock
+    double lastTime;   // arrival of the last clock
+    int clocks;        // clocks since the loop (re)locked, 2 and more when locked
+};
+
+#endif
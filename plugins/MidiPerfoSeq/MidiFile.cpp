@@ -0,0 +1,274 @@
+/*
+ * Standard midi file import and export of MidiPerfoSeq patterns.
+ */
+
+#include "MidiFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+/*
+ * Sequential reader over a file with a fixed read buffer,
+ * so files of any size are streamed instead of loaded at once.
+ */
+class FileReader
+{
+public:
+    explicit FileReader(const char* filename)
+        : file(std::fopen(filename, "rb")), pos(0), fill(0), consumed(0), failed(file == nullptr) {}
+
+    ~FileReader()
+    {
+        if (file != nullptr) std::fclose(file);
+    }
+
+    bool ok() const { return ! failed; }
+
+    // bytes read or skipped so far
+    uint64_t position() const { return consumed; }
+
+    uint8_t byte()
+    {
+        if (pos == fill && ! refill()) return 0;
+        consumed += 1;
+        return buffer[pos++];
+    }
+
+    uint32_t bigEndian(int bytes)
+    {
+        uint32_t value = 0;
+        for (int i=0;i<bytes;i++) value = (value << 8) | byte();
+        return value;
+    }
+
+    // variable length quantity, at most 4 bytes
+    uint32_t variableLength()
+    {
+        uint32_t value = 0;
+        for (int i=0;i<4;i++)
+        {
+            const uint8_t b = byte();
+            value = (value << 7) | (b & 0x7F);
+            if ((b & 0x80) == 0) break;
+        }
+        return value;
+    }
+
+    void skip(uint32_t bytes)
+    {
+        while (bytes > 0 && ! failed)
+        {
+            if (pos == fill && ! refill()) return;
+            const uint32_t chunk = std::min<uint32_t>(bytes, uint32_t(fill - pos));
+            pos += chunk;
+            consumed += chunk;
+            bytes -= chunk;
+        }
+    }
+
+private:
+    bool refill()
+    {
+        if (failed) return false;
+        fill = std::fread(buffer, 1, sizeof(buffer), file);
+        pos = 0;
+        if (fill == 0) failed = true;
+        return ! failed;
+    }
+
+    std::FILE* file;
+    uint8_t buffer[16384];
+    size_t pos;
+    size_t fill;
+    uint64_t consumed;
+    bool failed;
+};
+
+struct Onset {
+    uint32_t tick;
+    uint8_t status;
+    uint8_t note;
+    uint8_t velocity;
+};
+
+/*
+ * Collects the note ons of one track chunk.
+ */
+void readTrack(FileReader& reader, uint32_t length, std::vector<Onset>& onsets)
+{
+    const uint64_t end = reader.position() + length;
+    uint32_t tick = 0;
+    uint8_t runningStatus = 0;
+
+    while (reader.position() < end && reader.ok())
+    {
+        tick += reader.variableLength();
+        uint8_t status = reader.byte();
+        if (status == 0xFF)  // meta event
+        {
+            const uint8_t type = reader.byte();
+            reader.skip(reader.variableLength());
+            if (type == 0x2F) break;  // end of track
+            continue;
+        }
+        if (status == 0xF0 || status == 0xF7)  // sysex
+        {
+            reader.skip(reader.variableLength());
+            continue;
+        }
+
+        uint8_t data1;
+        if (status & 0x80)
+        {
+            runningStatus = status;
+            data1 = reader.byte();
+        }
+        else
+        {
+            data1 = status;
+            status = runningStatus;
+        }
+        switch (status & 0xF0)
+        {
+            case 0xC0:
+            case 0xD0:
+                break;
+            case 0x90:
+            {
+                const uint8_t data2 = reader.byte();
+                if (data2 > 0)  // velocity 0 is a note off
+                {
+                    const Onset onset = { tick, status, uint8_t(data1 & 0x7F), uint8_t(data2 & 0x7F) };
+                    onsets.push_back(onset);
+                }
+                break;
+            }
+            default:
+                reader.byte();
+                break;
+        }
+    }
+    if (reader.position() < end) reader.skip(uint32_t(end - reader.position()));
+}
+
+void writeBigEndian(std::vector<uint8_t>& out, uint32_t value, int bytes)
+{
+    for (int i=bytes-1;i>=0;i--) out.push_back(uint8_t(value >> (8*i)));
+}
+
+void writeVariableLength(std::vector<uint8_t>& out, uint32_t value)
+{
+    uint8_t bytes[4];
+    int count = 0;
+    do
+    {
+        bytes[count++] = uint8_t(value & 0x7F);
+        value >>= 7;
+    } while (value && count < 4);
+    while (count-- > 0) out.push_back(uint8_t(bytes[count] | (count ? 0x80 : 0)));
+}
+
+} // namespace
+
+bool importMidiFile(const char* filename, PatternStore& pattern)
+{
+    pattern.clear();
+    FileReader reader(filename);
+    if (! reader.ok()) return false;
+    if (reader.bigEndian(4) != 0x4D546864) return false;  // "MThd"
+    const uint32_t headerLength = reader.bigEndian(4);
+    const uint32_t format = reader.bigEndian(2);
+    const uint32_t tracks = reader.bigEndian(2);
+    const uint32_t division = reader.bigEndian(2);
+    if (headerLength < 6 || format > 1 || ! reader.ok()) return false;
+    reader.skip(headerLength - 6);
+
+    // SMPTE time division has no beats, use a fixed window then
+    const uint32_t window = (division & 0x8000) ? 1 : std::max<uint32_t>(1, division / 16);
+
+    std::vector<Onset> onsets;
+    onsets.reserve(4096);
+    for (uint32_t t=0;t<tracks && reader.ok();t++)
+    {
+        const uint32_t chunkType = reader.bigEndian(4);
+        const uint32_t length = reader.bigEndian(4);
+        if (! reader.ok()) break;
+        if (chunkType != 0x4D54726B)  // not "MTrk"
+        {
+            reader.skip(length);
+            continue;
+        }
+        readTrack(reader, length, onsets);
+    }
+
+    // merge the tracks by time, notes of equal time keep their file order
+    std::stable_sort(onsets.begin(), onsets.end(),
+                     [](const Onset& a, const Onset& b) { return a.tick < b.tick; });
+
+    uint32_t stepTick = 0;
+    for (const Onset& onset : onsets)
+    {
+        if (pattern.empty() || onset.tick - stepTick >= window)
+        {
+            if (! pattern.appendStep()) break;
+            stepTick = onset.tick;
+        }
+        // SMPTE files have no quarter notes to scale the onsets by, their chords start at once
+        const uint32_t offset = (division & 0x8000) ? 0 : (onset.tick - stepTick) * PATTERN_TICKS_PER_QUARTER / division;
+        const PatternNote note = { onset.status, onset.note, onset.velocity, uint16_t(std::min<uint32_t>(offset, 0xFFFF)) };
+        pattern.appendNote(note);
+    }
+    return ! pattern.empty();
+}
+
+bool exportMidiFile(const char* filename, const PatternStore& pattern)
+{
+    const uint32_t division = 480;
+    std::vector<uint8_t> track;
+    uint32_t pendingDelta = 0;
+    for (int s=0;s<pattern.size();s++)
+    {
+        const PatternNote* notes = pattern.stepNotes(s);
+        const int count = pattern.stepLength(s);
+        uint32_t onsetTick = 0;
+        for (int i=0;i<count;i++)
+        {
+            // offsets are in PATTERN_TICKS_PER_QUARTER, rounded to the file division
+            const uint32_t tick = std::max(onsetTick, uint32_t(notes[i].offset) * division / PATTERN_TICKS_PER_QUARTER);
+            writeVariableLength(track, i == 0 ? pendingDelta + tick : tick - onsetTick);
+            onsetTick = tick;
+            track.push_back(uint8_t(0x90 | (notes[i].status & 0x0F)));
+            track.push_back(notes[i].note & 0x7F);
+            track.push_back(notes[i].velocity & 0x7F);
+        }
+        for (int i=0;i<count;i++)
+        {
+            writeVariableLength(track, i == 0 ? division / 2 : 0);
+            track.push_back(uint8_t(0x80 | (notes[i].status & 0x0F)));
+            track.push_back(notes[i].note & 0x7F);
+            track.push_back(0x40);
+        }
+        pendingDelta = count ? division / 2 : pendingDelta + division;
+    }
+    writeVariableLength(track, pendingDelta);
+    track.push_back(0xFF);  // end of track
+    track.push_back(0x2F);
+    track.push_back(0x00);
+
+    std::vector<uint8_t> file;
+    writeBigEndian(file, 0x4D546864, 4);  // "MThd"
+    writeBigEndian(file, 6, 4);
+    writeBigEndian(file, 0, 2);  // type 0
+    writeBigEndian(file, 1, 2);
+    writeBigEndian(file, division, 2);
+    writeBigEndian(file, 0x4D54726B, 4);  // "MTrk"
+    writeBigEndian(file, uint32_t(track.size()), 4);
+    file.insert(file.end(), track.begin(), track.end());
+
+    std::FILE* const out = std::fopen(filename, "wb");
+    if (out == nullptr) return false;
+    const bool written = std::fwrite(file.data(), 1, file.size(), out) == file.size();
+    return (std::fclose(out) == 0) && written;
+}
@@ -0,0 +1,24 @@
+#ifndef MIDI_PERFOSEQ_MIDI_FILE_INCLUDED
+#define MIDI_PERFOSEQ_MIDI_FILE_INCLUDED
+
+#include "PatternStore.h"
+
+/*
+ * Standard midi file (SMF) import and export of patterns.
+ * These read and write files and allocate, so they must not be called from run().
+ */
+
+/*
+ * Reads a type 0 or type 1 file into pattern (cleared first).
+ * Note ons of all tracks which start within a 64th note of each other form one step.
+ * Returns false if the file can't be read or isn't a midi file.
+ */
+bool importMidiFile(const char* filename, PatternStore& pattern);
+
+/*
+ * Writes pattern as a type 0 file, one step per quarter note, played for an eighth
+ * after its last note started. The notes of a step keep their onset offsets.
+ */
+bool exportMidiFile(const char* filename, const PatternStore& pattern);
+
+#endif
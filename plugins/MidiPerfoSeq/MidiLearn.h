@@ -0,0 +1,49 @@
+#ifndef MIDI_PERFOSEQ_MIDI_LEARN_INCLUDED
+#define MIDI_PERFOSEQ_MIDI_LEARN_INCLUDED
+
+#include "MidiPerfoSeq.h"
+#include <atomic>
+#include <cstdint>
+
+// values of the learn target parameter, parameter n is learnFirstParameter + n
+enum LearnTarget {
+    learnOff,
+    learnForget,
+    learnFirstParameter
+};
+
+/*
+ * Which parameter every controller of every midi channel drives, -1 for none.
+ * run() looks the controllers up and learns new ones, the state is read and
+ * written from the control thread. Every entry is a single atomic byte, so both
+ * sides only ever see whole bindings and neither one waits.
+ */
+class MidiLearnMap
+{
+public:
+    MidiLearnMap() { clear(); }
+
+    void clear()
+    {
+        for (int c=0;c<16;c++)
+            for (int n=0;n<128;n++) targets[c][n].store(-1, std::memory_order_relaxed);
+    }
+
+    int target(uint8_t channel, uint8_t controller) const
+    {
+        return targets[channel & 0x0F][controller & 0x7F].load(std::memory_order_relaxed);
+    }
+
+    void bind(uint8_t channel, uint8_t controller, int parameter)
+    {
+        if (parameter < -1 || parameter >= parameterCount) return;
+        targets[channel & 0x0F][controller & 0x7F].store(int8_t(parameter), std::memory_order_relaxed);
+    }
+
+    void forget(uint8_t channel, uint8_t controller) { bind(channel, controller, -1); }
+
+private:
+    std::atomic<int8_t> targets[16][128];
+};
+
+#endif
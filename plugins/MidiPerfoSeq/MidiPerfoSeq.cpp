@@ -16,14 +16,145 @@
 
 #include "DistrhoPlugin.hpp"
 #include "MidiPerfoSeq.h"
-#include "iostream"
-#include <random>
-#include <queue>
+#include "PatternStore.h"
+#include "SequencerLane.h"
+#include "EventScheduler.h"
+#include "OutputBuffer.h"
+#include "ActiveNoteTable.h"
+#include "ParameterExchange.h"
+#include "TraceRing.h"
+#include "PatternState.h"
+#include "MidiFile.h"
+#include "MidiLearn.h"
+#include "MidiClockTracker.h"
+#include "PitchTable.h"
+#include "extra/Base64.hpp"
+#ifdef MIDIPERFOSEQ_BLOCK_STATS
+#include "BlockStats.h"
+#include <chrono>
+#endif
+#ifdef MIDIPERFOSEQ_TRACE
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#endif
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef MIDIPERFOSEQ_RT_ALLOC_GUARD
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+/*
+ * Debug build only: replace the global allocator and abort as soon as the
+ * audio thread asks for heap memory while it is inside run().
+ * Meant for the jack standalone target and the tests, where the plugin is linked into the executable.
+ */
+static thread_local bool rtAllocForbidden = false;
+
+static void rtAllocCheck()
+{
+    if (rtAllocForbidden)
+    {
+        std::fputs("MidiPerfoSeq: heap allocation inside run()\n", stderr);
+        std::abort();
+    }
+}
+
+static void* rtGuardedAlloc(std::size_t size)
+{
+    rtAllocCheck();
+    if (void* const ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+static void* rtGuardedAlignedAlloc(std::size_t size, std::align_val_t alignment)
+{
+    rtAllocCheck();
+    const std::size_t align = std::max(std::size_t(alignment), sizeof(void*));
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, align, size ? size : 1) == 0) return ptr;
+    throw std::bad_alloc();
+}
+
+// every form of new and delete, so nothing allocated here is freed by the runtime or the other way round
+void* operator new(std::size_t size) { return rtGuardedAlloc(size); }
+void* operator new[](std::size_t size) { return rtGuardedAlloc(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return rtGuardedAlloc(size); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return rtGuardedAlloc(size); } catch (...) { return nullptr; }
+}
+void* operator new(std::size_t size, std::align_val_t alignment) { return rtGuardedAlignedAlloc(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return rtGuardedAlignedAlloc(size, alignment); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    try { return rtGuardedAlignedAlloc(size, alignment); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    try { return rtGuardedAlignedAlloc(size, alignment); } catch (...) { return nullptr; }
+}
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { std::free(ptr); }
+
+struct RtAllocScope {
+    RtAllocScope() { rtAllocForbidden = true; }
+    ~RtAllocScope() { rtAllocForbidden = false; }
+};
+#endif
+
+#ifdef MIDIPERFOSEQ_SELF_CHECK
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * Debug build only: the sequencer compares itself with a reference model and checks
+ * its invariants while it runs, any host session or midi file player becomes a test.
+ * A failure aborts, so it is caught by a debugger or a sanitizer build.
+ */
+static void selfCheck(bool condition, const char* what)
+{
+    if (condition) return;
+    std::fprintf(stderr, "MidiPerfoSeq: self check failed: %s\n", what);
+    std::abort();
+}
+#endif
 
 START_NAMESPACE_DISTRHO
 
 // -----------------------------------------------------------------------------------------------------------
 
+// length of one clocked step in quarter notes, indexed by ClockRate
+static const double kClockRateQuarters[clockRateCount] = {
+    1.0, 0.5, 0.25, 0.125,
+    2.0/3.0, 1.0/3.0, 1.0/6.0, 1.0/12.0
+};
+
+static const char* const kClockRateLabels[clockRateCount] = {
+    "1/4", "1/8", "1/16", "1/32", "1/4T", "1/8T", "1/16T", "1/32T"
+};
+
+// -----------------------------------------------------------------------------------------------------------
+
 /**
  * Plugin that demonstrates MIDI output in DPF.
  */
@@ -31,7 +162,7 @@ class MidiPerfoSeqPlugin : public Plugin
 {
 public:
     MidiPerfoSeqPlugin()
-    : Plugin(10, 0, 0),b_record(0.0f),b_reset(0.0f) {
+    : Plugin(parameterCount, 0, statesCount),b_record(0.0f),b_reset(0.0f) {
         noteNames.push_back(DISTRHO::String("C"));
         noteNames.push_back(DISTRHO::String("C#"));
         noteNames.push_back(DISTRHO::String("D"));
@@ -44,8 +175,46 @@ public:
         noteNames.push_back(DISTRHO::String("A"));
         noteNames.push_back(DISTRHO::String("A#"));
         noteNames.push_back(DISTRHO::String("B"));
+        for (int i=0;i<MAX_PATTERN_SLOTS;i++)
+        {
+            slots[i] = &patternStores[i];
+            for (int b=0;b<RESTORE_BANK_COUNT;b++) restoreBanks[b].stores[i] = &patternStores[(b+1)*MAX_PATTERN_SLOTS+i];
+            publishedSlots[i].store(slots[i]);
+        }
+        // lane n starts on slot n
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            lanes[i].playingSlot = lanes[i].selectedSlot = i % MAX_PATTERN_SLOTS;
+            lanes[i].pattern = slots[lanes[i].playingSlot];
+            lanes[i].overdubStore = &overdubStores[i];
+        }
+        std::memset(keyLane, 0, sizeof(keyLane));
+        rebuildLaneMap();
+        // start from the declared defaults, applied by the first run()
+        for (uint32_t i=0;i<parameterCount;i++)
+        {
+            Parameter parameter;
+            initParameter(i, parameter);
+            appliedParameters[i] = 0.0f;
+            parameterApplied[i] = false;
+            controlRanges[i] = parameter.ranges;
+            controlHints[i] = parameter.hints;
+            if (! (parameter.hints & kParameterIsOutput)) parameters.set(i, parameter.ranges.def);
+        }
+#ifdef MIDIPERFOSEQ_TRACE
+        traceRunning.store(true);
+        traceThread = std::thread([this] { drainTrace(); });
+#endif
     }
 
+#ifdef MIDIPERFOSEQ_TRACE
+    ~MidiPerfoSeqPlugin() override
+    {
+        traceRunning.store(false);
+        traceThread.join();
+    }
+#endif
+
 protected:
     /* --------------------------------------------------------------------------------------------------------
      * Information */
@@ -118,6 +287,22 @@ protected:
                 portGroup.name = "Key Transpose";
                 portGroup.symbol = "transpose";
                 break;
+            case gClock:
+                portGroup.name = "Clock";
+                portGroup.symbol = "clock";
+                break;
+            case gLanes:
+                portGroup.name = "Lanes";
+                portGroup.symbol = "lanes";
+                break;
+            case gRatchet:
+                portGroup.name = "Note Repeat";
+                portGroup.symbol = "noterepeat";
+                break;
+            case gMidiLearn:
+                portGroup.name = "MIDI Learn";
+                portGroup.symbol = "midilearn";
+                break;
             default:
                 break;
 
@@ -150,14 +335,14 @@ protected:
                 parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
                 parameter.name       = "Sequencer Style";
                 parameter.symbol     = "seqstyle";
-                parameter.ranges.max = 6.0f;
+                parameter.ranges.max = float(styleCount-1);
                 parameter.ranges.min = 0.0f;
                 parameter.ranges.def = 0.0f;
                 parameter.groupId   = gSequencer;
-                parameter.enumValues.count = 6;
+                parameter.enumValues.count = styleCount;
                 parameter.enumValues.restrictedMode = true;
                 {
-                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[6];
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[styleCount];
                     enumValues[0].value = 0.0f;
                     enumValues[0].label = "Forward";
                     enumValues[1].value = 1.0f;
@@ -170,6 +355,10 @@ protected:
                     enumValues[4].label = "Step (+up-down)";
                     enumValues[5].value = 5.0f;
                     enumValues[5].label = "Random";
+                    enumValues[6].value = 6.0f;
+                    enumValues[6].label = "Random (no repeat)";
+                    enumValues[7].value = 7.0f;
+                    enumValues[7].label = "Random (weighted by chord size)";
                     parameter.enumValues.values = enumValues;
                 }
                 break;
@@ -191,6 +380,15 @@ protected:
                 parameter.ranges.def = 1.0f;
                 parameter.groupId   = gSequencer;
                 break;
+            case seqSeed:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Random Seed";
+                parameter.symbol     = "seqSeed";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 65535.0f;
+                parameter.ranges.def = 0.0f;
+                parameter.groupId   = gSequencer;
+                break;
             case transposeSemi:
                 parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
                 parameter.name       = "Transpose Semi";
@@ -243,6 +441,127 @@ protected:
                     parameter.enumValues.values = enumValues;
                 }
                 break;
+            case clockMode:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Step Clock";
+                parameter.symbol     = "clockMode";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = float(clockModeCount-1);
+                parameter.ranges.def = 0.0f;
+                parameter.groupId   = gClock;
+                parameter.enumValues.count = clockModeCount;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[clockModeCount];
+                    enumValues[0].value = 0.0f;
+                    enumValues[0].label = "Key Release";
+                    enumValues[1].value = 1.0f;
+                    enumValues[1].label = "Host Transport";
+                    enumValues[2].value = 2.0f;
+                    enumValues[2].label = "MIDI Clock";
+                    enumValues[3].value = 3.0f;
+                    enumValues[3].label = "Key Pads";
+                    parameter.enumValues.values = enumValues;
+                }
+                break;
+            case clockRate:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Clock Rate";
+                parameter.symbol     = "clockRate";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = float(clockRateCount-1);
+                parameter.ranges.def = float(rateSixteenth);
+                parameter.groupId   = gClock;
+                parameter.enumValues.count = clockRateCount;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[clockRateCount];
+                    for (int i=0;i<clockRateCount;i++)
+                    {
+                        enumValues[i].value = float(i);
+                        enumValues[i].label = kClockRateLabels[i];
+                    }
+                    parameter.enumValues.values = enumValues;
+                }
+                break;
+            case gateLength:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Gate Length";
+                parameter.symbol     = "gateLength";
+                parameter.unit       = "%";
+                parameter.ranges.min = 1.0f;
+                parameter.ranges.max = 100.0f;
+                parameter.ranges.def = 50.0f;
+                parameter.groupId   = gClock;
+                break;
+            case patternSlot:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Pattern Slot";
+                parameter.symbol     = "patternSlot";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = float(MAX_PATTERN_SLOTS-1);
+                parameter.ranges.def = 0.0f;
+                parameter.groupId   = gSequencer;
+                parameter.enumValues.count = MAX_PATTERN_SLOTS;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[MAX_PATTERN_SLOTS];
+                    for (int i=0;i<MAX_PATTERN_SLOTS;i++)
+                    {
+                        enumValues[i].value = float(i);
+                        enumValues[i].label = String("Slot ") + String(i+1);
+                    }
+                    parameter.enumValues.values = enumValues;
+                }
+                break;
+            case laneMode:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Lanes";
+                parameter.symbol     = "laneMode";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = float(laneModeCount-1);
+                parameter.ranges.def = float(laneSingle);
+                parameter.groupId   = gLanes;
+                parameter.enumValues.count = laneModeCount;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[laneModeCount];
+                    enumValues[0].value = 0.0f;
+                    enumValues[0].label = "Single Lane";
+                    enumValues[1].value = 1.0f;
+                    enumValues[1].label = "By Channel";
+                    enumValues[2].value = 2.0f;
+                    enumValues[2].label = "By Key Zone";
+                    parameter.enumValues.values = enumValues;
+                }
+                break;
+            case laneSplit1:
+            case laneSplit2:
+            case laneSplit3:
+            {
+                const int split = int(index - laneSplit1);
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = String("Lane Split ") + String(split+1);
+                parameter.symbol     = String("laneSplit") + String(split+1);
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 127.0f;
+                parameter.ranges.def = float(48 + 12*split);
+                parameter.groupId   = gLanes;
+                parameter.enumValues.count = 128;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[128];
+                    for (int i=0;i<128;i++)
+                    {
+                        enumValues[i].value = float(i);
+                        int iname = i%12;
+                        int iOctave = (i-iname)/12-2;
+                        enumValues[i].label = noteNames[iname]+DISTRHO::String(iOctave);
+                    }
+                    parameter.enumValues.values = enumValues;
+                }
+                break;
+            }
             case groupNumber:
                 parameter.hints      = kParameterIsOutput+kParameterIsInteger;
                 parameter.name       = "Steps";
@@ -259,79 +578,274 @@ protected:
                 parameter.ranges.max = float(MAX_NOTE_ON_GROUPS);
                 parameter.ranges.def = 0.0f;
                 break;
-            default:
+            case droppedEvents:
+                parameter.hints      = kParameterIsOutput+kParameterIsInteger;
+                parameter.name       = "Dropped Events";
+                parameter.symbol     = "droppedEvents";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 1000000.0f;
+                parameter.ranges.def = 0.0f;
                 break;
-        }
-    }
-    float getParameterValue(uint32_t index) const   override
-    {
-        switch (index)
-        {
-            case bRecord:
-                return b_record;
+            case ratchetCount:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Repeats";
+                parameter.symbol     = "ratchetCount";
+                parameter.ranges.min = 1.0f;
+                parameter.ranges.max = float(MAX_RATCHET_HITS);
+                parameter.ranges.def = 1.0f;
+                parameter.groupId   = gRatchet;
                 break;
-            case bReset:
-                return b_reset;
+            case ratchetRate:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Repeat Rate";
+                parameter.symbol     = "ratchetRate";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = float(clockRateCount-1);
+                parameter.ranges.def = float(rateThirtySecond);
+                parameter.groupId   = gRatchet;
+                parameter.enumValues.count = clockRateCount;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[clockRateCount];
+                    for (int i=0;i<clockRateCount;i++)
+                    {
+                        enumValues[i].value = float(i);
+                        enumValues[i].label = kClockRateLabels[i];
+                    }
+                    parameter.enumValues.values = enumValues;
+                }
                 break;
-            case seqStyle:
-                return sequencerStyle;
+            case ratchetDecay:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Repeat Decay";
+                parameter.symbol     = "ratchetDecay";
+                parameter.unit       = "%";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 100.0f;
+                parameter.ranges.def = 15.0f;
+                parameter.groupId   = gRatchet;
                 break;
-            case seqStepsUp:
-                return sequencerSubStepsUp;
+            case strumScale:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Strum";
+                parameter.symbol     = "strumScale";
+                parameter.unit       = "%";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 400.0f;
+                parameter.ranges.def = 100.0f;
+                parameter.groupId   = gSequencer;
                 break;
-            case seqStepsDown:
-                return sequencerSubStepsDown;
+            case scaleType:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Scale";
+                parameter.symbol     = "scaleType";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = float(scaleTypeCount-1);
+                parameter.ranges.def = float(scaleChromatic);
+                parameter.groupId   = gTranspose;
+                parameter.enumValues.count = scaleTypeCount;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[scaleTypeCount];
+                    const char* const labels[scaleTypeCount] = { "Chromatic", "Major", "Minor", "Dorian", "Phrygian", "Lydian",
+                                                                 "Mixolydian", "Locrian", "Harmonic Minor", "Major Pentatonic", "Minor Pentatonic" };
+                    for (int i=0;i<scaleTypeCount;i++)
+                    {
+                        enumValues[i].value = float(i);
+                        enumValues[i].label = labels[i];
+                    }
+                    parameter.enumValues.values = enumValues;
+                }
                 break;
-            case transposeSemi:
-                return transposeSemiNotes;
+            case learnTarget:
+                parameter.hints      = kParameterIsInteger;
+                parameter.name       = "Learn Controller For";
+                parameter.symbol     = "learnTarget";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = float(learnFirstParameter + parameterCount - 1);
+                parameter.ranges.def = float(learnOff);
+                parameter.groupId   = gMidiLearn;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    // every input parameter but the learn settings can be learned
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[learnFirstParameter + parameterCount];
+                    int count = 0;
+                    enumValues[count].value = float(learnOff);
+                    enumValues[count++].label = "Off";
+                    enumValues[count].value = float(learnForget);
+                    enumValues[count++].label = "Forget";
+                    for (uint32_t i=0;i<parameterCount;i++)
+                    {
+                        if (i == learnTarget || i == learnFilter) continue;
+                        Parameter learned;
+                        initParameter(i, learned);
+                        if (learned.hints & kParameterIsOutput) continue;
+                        enumValues[count].value = float(learnFirstParameter + int(i));
+                        enumValues[count++].label = learned.name;
+                    }
+                    parameter.enumValues.count = uint8_t(count);
+                    parameter.enumValues.values = enumValues;
+                }
                 break;
-            case transposeKey:
-                return transposeOnKeys;
+            case learnFilter:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsBoolean;
+                parameter.name       = "Filter Learned Controllers";
+                parameter.symbol     = "learnFilter";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 1.0f;
+                parameter.ranges.def = 0.0f;
+                parameter.groupId   = gMidiLearn;
                 break;
-            case transposeKeyBase:
-                return transposeBaseKey;
+            case overdub:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsBoolean;
+                parameter.name       = "Overdub";
+                parameter.symbol     = "overdub";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 1.0f;
+                parameter.ranges.def = 0.0f;
+                parameter.groupId   = gRecord;
+                break;
+            case replaceSteps:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsBoolean;
+                parameter.name       = "Overdub Replaces Steps";
+                parameter.symbol     = "replaceSteps";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 1.0f;
+                parameter.ranges.def = 0.0f;
+                parameter.groupId   = gRecord;
+                break;
+            case scaleRoot:
+                parameter.hints      = kParameterIsAutomatable+kParameterIsInteger;
+                parameter.name       = "Scale Root";
+                parameter.symbol     = "scaleRoot";
+                parameter.ranges.min = 0.0f;
+                parameter.ranges.max = 11.0f;
+                parameter.ranges.def = 0.0f;
+                parameter.groupId   = gTranspose;
+                parameter.enumValues.count = 12;
+                parameter.enumValues.restrictedMode = true;
+                {
+                    ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[12];
+                    for (int i=0;i<12;i++)
+                    {
+                        enumValues[i].value = float(i);
+                        enumValues[i].label = noteNames[i];
+                    }
+                    parameter.enumValues.values = enumValues;
+                }
+                break;
+            default:
                 break;
+        }
+    }
+    float getParameterValue(uint32_t index) const   override
+    {
+        switch (index)
+        {
             case groupNumber:
-                return noteOnQueueVector.size();
+                return publishedGroupNumber.load(std::memory_order_relaxed);
                 break;
             case actualGroup:
-                return noteOnQueueVectorIndex+1;
+                return publishedActualGroup.load(std::memory_order_relaxed);
+                break;
+            case droppedEvents:
+                return float(publishedDroppedEvents.load(std::memory_order_relaxed));
+                break;
             default:
-                return 0.0;
+                return parameters.get(index);
                 break;
         }
     }
+
+    /*
+     * Called by the host, maybe from another thread than run().
+     * The value is handed over lock free and applied by run() at the start of the next block.
+     */
     void  setParameterValue(uint32_t index, float value)  override
+    {
+        parameters.set(index, value);
+    }
+
+    /*
+     * Takes a parameter value over into the sequencer, audio thread only.
+     */
+    void applyParameterValue(uint32_t index, float value)
     {
         switch (index)
         {
             case bRecord:
                 b_record = (value > 0);
-                //noteOnQueueVectorIndex = 0;  // index auf Null setzen
+                //sequencerIndex = 0;  // index auf Null setzen
                 break;
             case bReset:
                 b_reset = (value > 0);
-                //noteOnQueueVector.clear();
-                //noteOnQueueVectorIndex = 0;  // index auf Null setzen
+                //pattern->clear();
+                //sequencerIndex = 0;  // index auf Null setzen
                 break;
             case seqStyle:
                 sequencerStyle = int(value);
-                // noteOnQueueVectorIndex=0;
+                markStepOrderDirty();
+                // sequencerIndex=0;
                 // sequencerStep=0;
                 // sequencerSubStep=0;
                 break;
             case seqStepsUp:
                 sequencerSubStepsUp = int(value);
-                // noteOnQueueVectorIndex=0;
+                markStepOrderDirty();
+                // sequencerIndex=0;
                 // sequencerStep=0;
                 // sequencerSubStep=0;
                 break;
             case seqStepsDown:
                 sequencerSubStepsDown = int(value);
-                // noteOnQueueVectorIndex=0;
+                markStepOrderDirty();
+                // sequencerIndex=0;
                 // sequencerStep=0;
                 // sequencerSubStep=0;
                 break;
+            case seqSeed:
+                randomSeed = int(value);
+                for (int i=0;i<MAX_SEQUENCER_LANES;i++) lanes[i].random.seed(uint32_t(randomSeed));
+                break;
+            case clockMode:
+                stepClockMode = int(value);
+                midiStepTime = -1.0;
+                break;
+            case clockRate:
+                stepClockRate = int(value);
+                if (stepClockRate < 0 || stepClockRate >= clockRateCount) stepClockRate = rateSixteenth;
+                break;
+            case gateLength:
+                stepGateLength = int(value);
+                break;
+            case ratchetCount:
+                ratchetHits = int(value);
+                if (ratchetHits < 1 || ratchetHits > MAX_RATCHET_HITS) ratchetHits = 1;
+                break;
+            case ratchetRate:
+                ratchetRateIndex = int(value);
+                if (ratchetRateIndex < 0 || ratchetRateIndex >= clockRateCount) ratchetRateIndex = rateThirtySecond;
+                break;
+            case ratchetDecay:
+                ratchetDecayPercent = int(value);
+                break;
+            case strumScale:
+                strumPercent = int(value);
+                break;
+            case patternSlot:
+                lanes[0].selectedSlot = int(value);
+                if (lanes[0].selectedSlot < 0 || lanes[0].selectedSlot >= MAX_PATTERN_SLOTS) lanes[0].selectedSlot = 0;
+                break;
+            case laneMode:
+                laneDispatchMode = int(value);
+                laneMapDirty = true;
+                break;
+            case laneSplit1:
+            case laneSplit2:
+            case laneSplit3:
+                laneSplitKeys[index - laneSplit1] = int(value);
+                laneMapDirty = true;
+                break;
             case transposeSemi:
                 transposeSemiNotes = int(value);
                 break;
@@ -340,313 +854,1898 @@ protected:
                 break;
             case transposeKeyBase:
                 transposeBaseKey = int(value);
+                for (int i=0;i<MAX_SEQUENCER_LANES;i++) lanes[i].keyStepsDirty = true;
+                break;
+            case scaleType:
+                transposeScale = int(value);
+                pitchTable.update(transposeScale, transposeScaleRoot);
+                break;
+            case scaleRoot:
+                transposeScaleRoot = int(value);
+                pitchTable.update(transposeScale, transposeScaleRoot);
+                break;
+            case learnTarget:
+                learnTargetValue = int(value);
+                break;
+            case learnFilter:
+                learnFilterOn = (value > 0);
+                break;
+            case overdub:
+                overdubOn = (value > 0);
+                break;
+            case replaceSteps:
+                replaceStepsOn = (value > 0);
                 break;
             default:
                 break;
         }
     }
 
-    /* --------------------------------------------------------------------------------------------------------
-     * Audio/MIDI Processing */
-
+    /*
+     * Style settings changed: every lane rebuilds its step order with its next step.
+     */
+    void markStepOrderDirty()
+    {
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++) lanes[i].stepOrderDirty = true;
+    }
 
     /*
-     * Depending on the sequencer type the next index is evaluated from the size of the noteOnQueueVector vector
+     * Precomputes the lane of every channel and key, so dispatching an event is a table lookup,
+     * and which lanes the lane mode uses at all.
      */
-    int getNextSequencerIndex()
+    void rebuildLaneMap()
     {
-        switch (sequencerStyle)
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++) laneInUse[i] = false;
+        for (int channel=0;channel<16;channel++)
         {
-            case 0:  // forward
-            {
-                noteOnQueueVectorIndex += 1;
-                break;
-            }
-            case 1:  // backward
-            {
-                noteOnQueueVectorIndex += noteOnQueueVector.size();
-                noteOnQueueVectorIndex -= 1;
-                break;
-            }
-            case 2:  // ping pong
-            {
-                if (sequencerStep==0) sequencerStep=1;
-                noteOnQueueVectorIndex += sequencerStep;
-                if (noteOnQueueVectorIndex == noteOnQueueVector.size()-1) sequencerStep=-1;
-                if (noteOnQueueVectorIndex <=0) sequencerStep=1;
-                break;
-            }
-            case 3:  // spiral
+            for (int key=0;key<128;key++)
             {
-                if (sequencerStep %2)
-                {
-                    noteOnQueueVectorIndex = sequencerStep/2;
-                } else
+                int index = 0;
+                switch (laneDispatchMode)
                 {
-                    noteOnQueueVectorIndex = (2*noteOnQueueVector.size()-1-sequencerStep)/2;
+                    case laneByChannel:
+                        index = channel % MAX_SEQUENCER_LANES;
+                        break;
+                    case laneByKeyZone:
+                        // one zone above each split key, in whatever order the splits are set
+                        for (int i=0;i<MAX_SEQUENCER_LANES-1;i++) if (key >= laneSplitKeys[i]) index += 1;
+                        break;
+                    default:
+                        break;
                 }
-                sequencerStep = (sequencerStep + 1) % noteOnQueueVector.size();
-                break;
+                laneOfKey[channel][key] = uint8_t(index);
+                laneInUse[index] = true;
             }
-            case 4:  // +sequencerSubStepsUp -sequencerSubStepsDown
-            {
-                if (sequencerSubStep<sequencerSubStepsUp-1)
-                    noteOnQueueVectorIndex += 1;
+        }
+        // an unused lane has no recording to clear, it plays its slot once the lane mode uses it
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            if (laneInUse[i] || lanes[i].machineState != init) continue;
+            lanes[i].machineState = play;
+            lanes[i].eventMode = kLaneEventModes[play][lanes[i].lastMachineState];
+        }
+        laneMapDirty = false;
+    }
+
+    /*
+     * The lane an event belongs to. Note offs go to the lane which got the note on,
+     * even when the lane settings have changed in between, other channel messages
+     * to the lane of the lowest zone of their channel.
+     */
+    int dispatchLane(const MidiEvent& event)
+    {
+        const uint8_t channel = event.data[0] & 0x0F;
+        const uint8_t key = event.data[1] & 0x7F;
+        switch (event.data[0] & 0xF0)
+        {
+            case 0x90:
+                keyLane[channel][key] = laneOfKey[channel][key];
+                return keyLane[channel][key];
+            case 0x80:
+                return keyLane[channel][key];
+            case 0xA0:
+                return laneOfKey[channel][key];
+            default:
+                return laneOfKey[channel][0];
+        }
+    }
+
+    /* --------------------------------------------------------------------------------------------------------
+     * Audio/MIDI Processing */
+
+    /**
+     *    Restart the frame clock, pending events of a previous run are dropped.
+     *    Notes still sounding and note offs not written yet go out with the first block,
+     *    keys held at deactivation are forgotten, their releases may never arrive.
+     */
+    void activate() override
+    {
+        scheduler.clear();
+        output.keepNoteOffs();
+        passedFrame = 0;
+        const auto release = [this](uint8_t channel, uint8_t note) {
+            MidiEvent me;
+            me.frame = 0;
+            me.size = 3;
+            me.data[0] = uint8_t(0x80 + channel);
+            me.data[1] = note;
+            me.data[2] = 0;
+            me.data[3] = 0;
+            me.dataExt = nullptr;
+            output.add(me);
+        };
+        activeNotes.releaseAll(release);
+        thruNotes.releaseAll(release);
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            lanes[i].heldKeys.clear();
+            lanes[i].activeNoteOnCount = 0;
+            lanes[i].heldNoteCount = 0;
+            lanes[i].ratchet.remaining = 0;
+            lanes[i].strum.cancel();
+        }
+        blockStartTime = 0;
+        clockTickValid = false;
+        hostTransportPlaying = false;
+        midiClockTracker.reset(getSampleRate());
+        midiClockRunning = false;
+        midiStepTime = -1.0;
+        lastScheduledTime = 0;
+        audioActive.store(true);
+    }
+
+    void deactivate() override
+    {
+        audioActive.store(false);
+        takeRestoredSlots();  // no run() will pick it up
+#ifdef MIDIPERFOSEQ_BLOCK_STATS
+        for (int i=0;i<styleCount;i++)
+        {
+            char name[64];
+            std::snprintf(name, sizeof(name), "MidiPerfoSeq style %d, %d steps", i, lanes[0].pattern->size());
+            blockStats[i].report(name);
+            blockStats[i].reset();
+        }
+#endif
+    }
+
+    /* --------------------------------------------------------------------------------------------------------
+     * State */
+
+    void initState(uint32_t index, State& state) override
+    {
+        switch (index)
+        {
+            case sPattern:
+                state.key          = "pattern";
+                state.defaultValue = "";
+                state.label        = "Recorded Pattern";
+                state.hints        = kStateIsOnlyForDSP | kStateIsBase64Blob;
+                break;
+            case sImportMidiFile:
+                state.key          = "importMidiFile";
+                state.defaultValue = "";
+                state.label        = "Import MIDI File";
+                state.description  = "Standard MIDI file, note ons played together become one step";
+                state.hints        = kStateIsOnlyForDSP | kStateIsFilenamePath;
+                break;
+            case sExportMidiFile:
+                state.key          = "exportMidiFile";
+                state.defaultValue = "";
+                state.label        = "Export MIDI File";
+                state.description  = "Writes the recorded pattern as standard MIDI file";
+                state.hints        = kStateIsOnlyForDSP | kStateIsFilenamePath;
+                break;
+            case sMidiLearn:
+                state.key          = "midiLearn";
+                state.defaultValue = "";
+                state.label        = "Learned Controllers";
+                state.description  = "channel:controller:parameter index of every learned controller";
+                state.hints        = kStateIsOnlyForDSP;
+                break;
+            default:
+                break;
+        }
+    }
+
+    /*
+     * Encodes the pattern in use with the sequencer settings.
+     * Runs on a non realtime thread, a pattern modified by run() meanwhile is read again.
+     * Import and export are one-shot actions, a saved session doesn't repeat them.
+     */
+    String getState(const char* key) const override
+    {
+        if (std::strcmp(key, "midiLearn") == 0) return getMidiLearnState();
+        if (std::strcmp(key, "pattern") != 0) return String();
+
+        PatternSetting settings[parameterCount];
+        const int settingCount = getPatternSettings(settings);
+        std::vector<PatternStore> copies(MAX_PATTERN_SLOTS);
+        int copiedPlayingSlot = 0;
+        const int stepIndex = copySlots(copies.data(), copiedPlayingSlot);
+        const PatternStore* copiedSlots[MAX_PATTERN_SLOTS];
+        for (int i=0;i<MAX_PATTERN_SLOTS;i++) copiedSlots[i] = &copies[i];
+        std::vector<uint8_t> data(MAX_PATTERN_STATE_SIZE);
+        const int size = encodePatternState(copiedSlots, MAX_PATTERN_SLOTS, copiedPlayingSlot, stepIndex,
+                                            settings, settingCount, data.data());
+        return String::asBase64(data.data(), size_t(size));
+    }
+
+    /*
+     * Copies all slots in use (room for MAX_PATTERN_SLOTS stores), returns the step index of the first lane.
+     * Runs on a non realtime thread, slots modified by run() meanwhile are copied again.
+     */
+    int copySlots(PatternStore* copies, int& copiedPlayingSlot) const
+    {
+        for (;;)
+        {
+            const uint32_t revision = patternRevision.load(std::memory_order_acquire);
+            if ((revision & 1) == 0)
+            {
+                for (int i=0;i<MAX_PATTERN_SLOTS;i++) copies[i] = *publishedSlots[i].load(std::memory_order_acquire);
+                copiedPlayingSlot = publishedPlayingSlot.load(std::memory_order_relaxed);
+                const int stepIndex = publishedStepIndex.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (patternRevision.load(std::memory_order_relaxed) == revision) return stepIndex;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /*
+     * Decodes a saved pattern into a spare bank, off the audio thread.
+     * run() swaps it in with the next block.
+     */
+    void setState(const char* key, const char* value) override
+    {
+        if (std::strcmp(key, "importMidiFile") == 0)
+        {
+            if (value[0] == '\0') return;
+            RestoredBank& bank(claimRestoreBank());
+            const int slot = publishedSelectedSlot.load();
+            if (importMidiFile(value, *bank.stores[slot]))
+                bank.slotMask |= 1u << slot;
+            else
+            {
+                bank.slotMask &= ~(1u << slot);
+                d_stderr("MidiPerfoSeq: can't import midi file %s", value);
+            }
+            publishRestoreBank();
+            return;
+        }
+        if (std::strcmp(key, "exportMidiFile") == 0)
+        {
+            if (value[0] == '\0') return;
+            std::vector<PatternStore> copies(MAX_PATTERN_SLOTS);
+            int copiedPlayingSlot = 0;
+            copySlots(copies.data(), copiedPlayingSlot);
+            if (! exportMidiFile(value, copies[publishedSelectedSlot.load()]))
+                d_stderr("MidiPerfoSeq: can't export midi file %s", value);
+            return;
+        }
+        if (std::strcmp(key, "midiLearn") == 0)
+        {
+            setMidiLearnState(value);
+            return;
+        }
+        if (std::strcmp(key, "pattern") != 0) return;
+
+        const std::vector<uint8_t> data(d_getChunkFromBase64String(value));
+        RestoredBank& bank(claimRestoreBank());
+
+        PatternSetting settings[parameterCount];
+        int settingCount = 0;
+        int slotCount = 0;
+        int playing = 0;
+        int stepIndex = 0;
+        if (! decodePatternState(data.data(), int(data.size()), bank.stores, MAX_PATTERN_SLOTS,
+                                 slotCount, playing, stepIndex, settings, settingCount))
+        {
+            // the decoding may have overwritten any slot of a restore still waiting
+            bank.slotMask = 0;
+            publishRestoreBank();
+            return;
+        }
+        // the state replaces the whole bank
+        for (int i=slotCount;i<MAX_PATTERN_SLOTS;i++) bank.stores[i]->clear();
+        for (int i=0;i<settingCount;i++)
+            setParameterValue(settings[i].index, float(settings[i].value));
+        bank.slotMask = (1u << MAX_PATTERN_SLOTS) - 1;
+        bank.playingSlot = playing;
+        bank.stepIndex = stepIndex;
+        publishRestoreBank();
+    }
+
+    /*
+     * The learned controllers as text, "channel:controller:parameter" separated by spaces.
+     */
+    String getMidiLearnState() const
+    {
+        String text;
+        for (int c=0;c<16;c++)
+        {
+            for (int n=0;n<128;n++)
+            {
+                const int parameter = learnMap.target(uint8_t(c), uint8_t(n));
+                if (parameter < 0) continue;
+                char binding[32];
+                std::snprintf(binding, sizeof(binding), "%s%d:%d:%d", text.isEmpty() ? "" : " ", c, n, parameter);
+                text += binding;
+            }
+        }
+        return text;
+    }
+
+    /*
+     * Replaces the learned controllers, entries which don't fit are skipped.
+     */
+    void setMidiLearnState(const char* value)
+    {
+        learnMap.clear();
+        const char* pos = value;
+        while (*pos != '\0')
+        {
+            int channel, controller, parameter, length = 0;
+            if (std::sscanf(pos, " %d:%d:%d%n", &channel, &controller, &parameter, &length) != 3 || length == 0) break;
+            pos += length;
+            if (channel < 0 || channel > 15 || controller < 0 || controller > 127) continue;
+            if (parameter < 0 || parameter >= parameterCount || parameter == learnTarget || parameter == learnFilter) continue;
+            if (controlHints[parameter] & kParameterIsOutput) continue;
+            learnMap.bind(uint8_t(channel), uint8_t(controller), parameter);
+        }
+    }
+
+    /*
+     * The bank setState decodes into. A restore run() hasn't taken yet is taken back,
+     * so a later state goes on top of it instead of waiting for the audio thread.
+     */
+    RestoredBank& claimRestoreBank()
+    {
+        const uint32_t previous = restoreHandoverBank.exchange(uint32_t(restoreFillBank), std::memory_order_acq_rel);
+        restoreFillBank = int(previous & ~RESTORE_PENDING);
+        RestoredBank& bank(restoreBanks[restoreFillBank]);
+        if ((previous & RESTORE_PENDING) == 0)
+        {
+            bank.slotMask = 0;
+            bank.playingSlot = -1;
+            bank.stepIndex = 0;
+        }
+        return bank;
+    }
+
+    /*
+     * Hands the claimed bank over to run(), which swaps its slots in with the next block.
+     * The bank coming back is one run() is done with.
+     */
+    void publishRestoreBank()
+    {
+        RestoredBank& bank(restoreBanks[restoreFillBank]);
+        if (bank.slotMask == 0) return;
+        restoreFillBank = int(restoreHandoverBank.exchange(uint32_t(restoreFillBank) | RESTORE_PENDING,
+                                                           std::memory_order_acq_rel));
+        restoreBanks[restoreFillBank].slotMask = 0;
+        if (! audioActive.load()) takeRestoredSlots();
+    }
+
+    /*
+     * The sequencer settings stored with a pattern: all input parameters but the record/reset switches.
+     */
+    int getPatternSettings(PatternSetting* settings) const
+    {
+        int count = 0;
+        for (int i=0;i<parameterCount;i++)
+        {
+            if (i == bRecord || i == bReset || i == groupNumber || i == actualGroup || i == droppedEvents || i == learnTarget) continue;
+            settings[count].index = uint8_t(i);
+            settings[count].value = int32_t(std::lround(parameters.get(uint32_t(i))));
+            count += 1;
+        }
+        return count;
+    }
+
+    /*
+     * Swaps restored slots in, audio thread (or while the audio is inactive).
+     * Every slot is a pointer swap, no pattern data is copied.
+     */
+    void takeRestoredSlots()
+    {
+        if ((restoreHandoverBank.load(std::memory_order_acquire) & RESTORE_PENDING) == 0) return;
+        const uint32_t taken = restoreHandoverBank.exchange(uint32_t(restoreTakenBank), std::memory_order_acq_rel);
+        restoreTakenBank = int(taken & ~RESTORE_PENDING);
+        if ((taken & RESTORE_PENDING) == 0) return;  // setState took it back meanwhile
+        RestoredBank& bank(restoreBanks[restoreTakenBank]);
+        const uint32_t slotMask = bank.slotMask;
+        const int restoredPlayingSlot = bank.playingSlot;
+        const int restoredStepIndex = bank.stepIndex;
+        bank.slotMask = 0;
+        beginPatternChange();
+        for (int i=0;i<MAX_PATTERN_SLOTS;i++)
+        {
+            if ((slotMask & (1u << i)) == 0) continue;
+            PatternStore* const previous = slots[i];
+            slots[i] = bank.stores[i];
+            bank.stores[i] = previous;
+            publishedSlots[i].store(slots[i], std::memory_order_release);
+        }
+        endPatternChange();
+        // the playing slot and step index of the state belong to the first lane
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            SequencerLane& lane(lanes[i]);
+            // the first block would otherwise clear a bank restored before it
+            if (lane.machineState == init)
+            {
+                lane.machineState = play;
+                lane.eventMode = kLaneEventModes[play][lane.lastMachineState];
+            }
+            // a take on a restored slot would bring the old pattern back, the lane stops playing with it
+            if (lane.overdubSlot >= 0 && (slotMask & (1u << lane.overdubSlot)) != 0)
+            {
+                releaseHeldNotes(lane, currentFrame);
+                lane.overdubSlot = -1;
+            }
+            const bool restoredPlaying = i == 0 && restoredPlayingSlot >= 0;
+            if (! restoredPlaying && (slotMask & (1u << lane.playingSlot)) == 0) continue;
+            releaseHeldNotes(lane, currentFrame);
+            playSlot(lane, restoredPlaying ? restoredPlayingSlot : lane.playingSlot);
+            if (i == 0 && restoredStepIndex < lane.pattern->size()) lane.sequencerIndex = restoredStepIndex;
+        }
+    }
+
+    /*
+     * Makes a slot the playing one of a lane, starting at its first step.
+     */
+    void playSlot(SequencerLane& lane, int slot)
+    {
+        lane.playingSlot = slot;
+        lane.pattern = slots[slot];
+        lane.sequencerIndex = 0;
+        lane.stepOrderCursor = 0;
+        lane.stepOrderDirty = true;
+        lane.keyStepsDirty = true;
+    }
+
+    /*
+     * Called where a new step of the lane may start. When another slot has been selected
+     * it becomes the playing one now: a pointer change, nothing is copied.
+     */
+    void switchToSelectedSlot(SequencerLane& lane)
+    {
+        if (lane.selectedSlot == lane.playingSlot || lane.heldNoteCount > 0) return;
+        playSlot(lane, lane.selectedSlot);
+    }
+
+    /*
+     * A slot was recorded into or cleared, the lanes playing it have to follow.
+     * Lanes may share a slot, so this isn't limited to the recording lane.
+     */
+    void patternChanged(const PatternStore* changed, bool cleared)
+    {
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            SequencerLane& lane(lanes[i]);
+            if (lane.pattern != changed) continue;
+            lane.stepOrderDirty = true;
+            lane.keyStepsDirty = true;
+            if (! cleared) continue;
+            lane.random.seed(uint32_t(randomSeed));  // every new pattern replays the same random order
+            lane.sequencerIndex = 0;
+            lane.stepOrderCursor = 0;
+        }
+    }
+
+    /*
+     * Recording starts. With overdub on the take goes into the spare store of the lane,
+     * a copy of the selected slot (or empty after a reset), and the slot plays on unchanged.
+     * With replaceSteps on, a chord of the take replaces the step it plays in the copy.
+     * Without it a reset deferred by overdub clears the slot now.
+     */
+    void beginTake(SequencerLane& lane)
+    {
+        if (overdubOn)
+        {
+            if (lane.overdubReplace)
+                lane.overdubStore->clear();
+            else
+                lane.overdubStore->copyFrom(*slots[lane.selectedSlot]);
+            lane.overdubSlot = lane.selectedSlot;
+            lane.overdubReplace = false;
+            return;
+        }
+        if (! lane.overdubReplace) return;
+        lane.overdubReplace = false;
+        PatternStore* const recorded = slots[lane.selectedSlot];
+        beginPatternChange();
+        recorded->clear();
+        endPatternChange();
+        patternChanged(recorded, true);
+    }
+
+    /*
+     * The take is over: its store becomes the slot and the replaced store the spare one
+     * of the lane. Only the pointer is swapped, so the lanes playing the slot go on with
+     * the new steps from their next step on.
+     */
+    void publishTake(SequencerLane& lane)
+    {
+        const int slot = lane.overdubSlot;
+        PatternStore* const previous = slots[slot];
+        beginPatternChange();
+        slots[slot] = lane.overdubStore;
+        publishedSlots[slot].store(slots[slot], std::memory_order_release);
+        endPatternChange();
+        lane.overdubStore = previous;
+        lane.overdubSlot = -1;
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            SequencerLane& other(lanes[i]);
+            if (other.pattern != previous) continue;
+            other.pattern = slots[slot];
+            if (other.sequencerIndex >= other.pattern->size()) other.sequencerIndex = 0;
+        }
+        patternChanged(slots[slot], false);
+    }
+
+    /*
+     * Marks modifications of the pattern in use for getState() (seqlock writer side).
+     */
+    void beginPatternChange()
+    {
+        patternRevision.store(patternRevision.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endPatternChange()
+    {
+        patternRevision.store(patternRevision.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+
+    /*
+     * Depending on the sequencer style the next index is read from the step order table.
+     * The table is rebuilt here when the pattern length or the style settings have changed,
+     * which is bounded by MAX_STEP_ORDER_SIZE and doesn't allocate.
+     */
+    int getNextSequencerIndex(SequencerLane& lane)
+    {
+        if (lane.pattern->empty()) return lane.sequencerIndex;
+        if (sequencerStyle >= styleRandom)
+        {
+            lane.sequencerIndex = getRandomSequencerIndex(lane);
+            lane.stepOrderDirty = true;  // resync the cursor when leaving random
+            traceRecord(traceStep, blockStartTime + currentFrame, lane, lane.sequencerIndex, -1);
+            return lane.sequencerIndex;
+        }
+        if (lane.stepOrderDirty) rebuildStepOrder(lane);
+#ifdef MIDIPERFOSEQ_SELF_CHECK
+        const int previousPosition = lane.stepOrderCursor;
+#endif
+        lane.stepOrderCursor += 1;
+        if (lane.stepOrderCursor >= lane.stepOrder.length()) lane.stepOrderCursor = 0;
+        lane.sequencerIndex = lane.stepOrder.at(lane.stepOrderCursor);
+#ifdef MIDIPERFOSEQ_SELF_CHECK
+        selfCheck(lane.sequencerIndex == referenceNextIndex(lane.stepOrder.at(previousPosition), previousPosition,
+                                                            lane.pattern->size()),
+                  "step order table differs from the reference stepping");
+#endif
+        traceRecord(traceStep, blockStartTime + currentFrame, lane, lane.sequencerIndex, lane.stepOrderCursor);
+        return lane.sequencerIndex;
+    }
+
+#ifdef MIDIPERFOSEQ_SELF_CHECK
+    /*
+     * Reference model of the table: the step recurrence of the styles as the sequencer
+     * computed it step by step, with its direction and substep state derived from
+     * the position in the cycle.
+     */
+    int referenceNextIndex(int index, int position, int steps) const
+    {
+        switch (sequencerStyle)
+        {
+            case styleBackward:
+                index += steps - 1;
+                break;
+            case stylePingPong:  // up to the last step, then down to the first one
+                index += (position < steps-1 || steps == 1) ? 1 : -1;
+                break;
+            case styleSpiral:
+            {
+                const int sequencerStep = (position + 1) % steps;
+                index = (sequencerStep % 2) ? sequencerStep/2 : (2*steps-1-sequencerStep)/2;
+                break;
+            }
+            case styleStepUpDown:
+            {
+                const int stepsUp = sequencerSubStepsUp < 1 ? 1 : sequencerSubStepsUp;
+                if (position % stepsUp < stepsUp-1)
+                    index += 1;
                 else
-                    noteOnQueueVectorIndex -= sequencerSubStepsDown;
-                sequencerSubStep += 1;
-                sequencerSubStep %= sequencerSubStepsUp;
-                noteOnQueueVectorIndex += MAX_SEQUENCER_STEPS_SIZE * noteOnQueueVector.size();
+                    index -= sequencerSubStepsDown % steps;
+                index += MAX_SEQUENCER_STEPS_SIZE * steps;
+                break;
+            }
+            default:
+                index += 1;
+                break;
+        }
+        return index % steps;
+    }
+
+    /*
+     * Invariants which hold at the end of every block.
+     */
+    void checkInvariants() const
+    {
+        bool silent = scheduler.empty();
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            const SequencerLane& lane(lanes[i]);
+            selfCheck(lane.activeNoteOnCount >= 0, "negative key count");
+            selfCheck((lane.activeNoteOnCount == 0) == lane.heldKeys.empty(), "key count differs from the held keys");
+            selfCheck(lane.heldNoteCount == 0 || lane.activeNoteOnCount > 0, "chord sounding without a held key");
+            selfCheck(lane.pattern == slots[lane.playingSlot], "lane plays a stale slot");
+            selfCheck(lane.eventMode == kLaneEventModes[lane.machineState][lane.lastMachineState], "stale event mode");
+            selfCheck(lane.pattern->empty() || lane.sequencerIndex < lane.pattern->size(), "step index beyond the pattern");
+            selfCheck(lane.overdubSlot < 0 || lane.eventMode == eventsRecord, "overdub take outside recording");
+            if (lane.heldNoteCount > 0 || lane.padVoiceCount > 0) silent = false;
+        }
+        // every generated note is part of a held chord or has its note off scheduled
+        selfCheck(! silent || activeNotes.empty(), "stuck note");
+    }
+#endif
+
+    /*
+     * Random styles, drawn from the generator of the lane
+     */
+    int getRandomSequencerIndex(SequencerLane& lane)
+    {
+        const PatternStore& pattern(*lane.pattern);
+        const int steps = pattern.size();
+        switch (sequencerStyle)
+        {
+            case styleRandomNoRepeat:  // any step but the current one
+            {
+                if (steps < 2) return 0;
+                int index = int(lane.random.below(uint32_t(steps-1)));
+                if (index >= lane.sequencerIndex) index += 1;
+                return index;
+            }
+            case styleRandomWeighted:  // steps with more notes are picked more often
+            {
+                if (pattern.totalNotes() == 0) return 0;
+                return pattern.stepOfNote(int(lane.random.below(uint32_t(pattern.totalNotes()))));
+            }
+            default:
+                return int(lane.random.below(uint32_t(steps)));
+        }
+    }
+
+    /*
+     * Compiles the actual style into the step order table of the lane and
+     * places the cursor on the current step. A cursor still on it stays, so
+     * a step visited twice per cycle (ping pong) keeps its direction.
+     */
+    void rebuildStepOrder(SequencerLane& lane)
+    {
+        const int cursor = lane.stepOrderCursor;
+        const int subStep = lane.stepOrder.subStepAt(cursor);
+        lane.stepOrder.build(sequencerStyle, lane.pattern->size(), sequencerSubStepsUp, sequencerSubStepsDown);
+        if (lane.sequencerIndex >= lane.pattern->size()) lane.sequencerIndex = 0;
+        if (cursor >= lane.stepOrder.length() || lane.stepOrder.at(cursor) != lane.sequencerIndex)
+            lane.stepOrderCursor = lane.stepOrder.find(lane.sequencerIndex, subStep);
+        lane.stepOrderDirty = false;
+    }
+
+    /*
+     * Returns the actual step index in the pattern of the lane
+     */
+    int getSequencerIndex(SequencerLane& lane)
+    {
+        // a lane sharing its slot may have cleared it meanwhile
+        if (lane.sequencerIndex >= lane.pattern->size()) lane.sequencerIndex = 0;
+        return lane.sequencerIndex;
+    }
+
+
+    /*
+     * State machine logic of a lane, one transition.
+     * Returns true when the state has changed.
+     */
+    bool stepMachineState(SequencerLane& lane)
+    {
+        int& machineState(lane.machineState);
+        const int activeNoteOnCount = lane.activeNoteOnCount;
+        int oldMachineState = machineState;
+        switch (machineState)
+        {
+            case init:
+            {
+                // only the selected slot is cleared, the other slots keep their patterns
+                PatternStore* const recorded = slots[lane.selectedSlot];
+                releaseHeldNotes(lane, currentFrame);
+                // overdubbing: the open take is dropped, the slot plays on until the next one replaces it
+                lane.overdubSlot = -1;
+                lane.overdubReplace = overdubOn;
+                if (recorded->size() && ! overdubOn)
+                {
+                    beginPatternChange();
+                    recorded->clear();
+                    endPatternChange();
+                    patternChanged(recorded, true);
+                }
+                if (recorded->size()==0 || overdubOn) machineState = play;
+                break;
+            }
+            case play:
+            {
+                if (b_record == 1) machineState = recRequest;
+                if (b_reset == 1) machineState = initRequest;
+                break;
+            }
+            case recRequest:
+            {
+                if (activeNoteOnCount==0) machineState = rec;
+                if (b_record == 0) machineState = play;
+                if (b_reset == 1) machineState = initRequest;
+                break;
+            }
+            case rec:
+            {
+                if (b_record == 0) machineState = playRequest;
+                if (b_reset == 1) machineState = initRequest;
+                break;
+            }
+            case playRequest:
+            {
+                if (b_record == 1) machineState = rec;
+                if (activeNoteOnCount==0) machineState = play;
+                if (b_reset == 1) machineState = initRequest;
+                break;
+            }
+            case initRequest:
+            {
+                if ((b_reset == 0) & (activeNoteOnCount==0))
+                {
+                    //b_record = 0;
+                    machineState = init;
+                }
+                break;
+            }
+        }
+        if (machineState == oldMachineState) return false;
+        // a take starts and ends where no key of the lane is held
+        if (machineState == rec && oldMachineState == recRequest) beginTake(lane);
+        if (machineState == play && oldMachineState == playRequest && lane.overdubSlot >= 0) publishTake(lane);
+        lane.lastMachineState = oldMachineState;
+        lane.eventMode = kLaneEventModes[machineState][oldMachineState];
+        traceRecord(traceState, blockStartTime + currentFrame, lane, oldMachineState, machineState);
+        return true;
+    }
+
+    /*
+     * Runs the state machine of a lane until it is stable. It is evaluated at the start
+     * of each block (parameter changes arrive with the block) and after every midi event
+     * of the lane, so record and play boundaries land on the frame of the causing event.
+     * Lanes the lane mode doesn't use keep their state, record and reset don't reach their slots.
+     */
+    void updateMachineState(SequencerLane& lane)
+    {
+        if (! laneInUse[&lane - lanes]) return;
+        for (int i=0; i<stateCount && stepMachineState(lane); ++i) {}
+    }
+
+    /*
+     * Every generated event leaving the plugin goes through here. It is staged and written
+     * in frame order ahead of the next input event passed on, at the end of the block or
+     * in a later one. An event dated before input already passed on goes out right after it.
+     */
+    void emitMidiEvent(const MidiEvent& event)
+    {
+        traceRecord(traceEvent, blockStartTime + event.frame, lanes[0], 0, 0, 0, event.data);
+        MidiEvent staged(event);
+        if (staged.frame < passedFrame) staged.frame = passedFrame;
+        if (! output.add(staged)) droppedEventCount += 1;
+    }
+
+    /*
+     * Every input event passed to the output goes through here. The staged events due up to
+     * its frame go first, then it is written at once, so no amount of input fills the stage.
+     */
+    void passMidiEvent(const MidiEvent& event)
+    {
+        traceRecord(traceEvent, blockStartTime + event.frame, lanes[0], 0, 0, 0, event.data);
+        droppedEventCount += uint32_t(output.writeUntil(event.frame, [this](const MidiEvent& staged) { return writeMidiEvent(staged); }));
+        if (! writeMidiEvent(event)) droppedEventCount += 1;
+        passedFrame = event.frame;
+    }
+
+    /*
+     * Hands a record to the trace thread, compiled to nothing without MIDIPERFOSEQ_TRACE.
+     */
+#ifdef MIDIPERFOSEQ_TRACE
+    void traceRecord(int kind, uint64_t time, const SequencerLane& lane, int32_t a, int32_t b,
+                     uint32_t c = 0, const uint8_t* data = nullptr)
+    {
+        TraceRecord record;
+        record.time = time;
+        record.a = a;
+        record.b = b;
+        record.c = c;
+        record.kind = uint8_t(kind);
+        record.lane = uint8_t(&lane - lanes);
+        for (int i=0;i<3;i++) record.data[i] = data != nullptr ? data[i] : 0;
+        trace.push(record);
+    }
+#else
+    void traceRecord(int, uint64_t, const SequencerLane&, int32_t, int32_t,
+                     uint32_t = 0, const uint8_t* = nullptr)
+    {
+    }
+#endif
+
+#ifdef MIDIPERFOSEQ_TRACE
+    /*
+     * Trace consumer thread: prints what run() recorded every 20 ms, to the file
+     * named by the environment variable MIDIPERFOSEQ_TRACE_FILE or to stderr.
+     */
+    void drainTrace()
+    {
+        const char* const path = std::getenv("MIDIPERFOSEQ_TRACE_FILE");
+        std::FILE* const file = path != nullptr ? std::fopen(path, "w") : nullptr;
+        std::FILE* const out = file != nullptr ? file : stderr;
+        for (bool running = true; running;)
+        {
+            running = traceRunning.load();  // a last pass after the stop
+            TraceRecord record;
+            while (trace.pop(record)) printTraceRecord(out, record);
+            if (const uint32_t dropped = trace.takeDropped())
+                std::fprintf(out, "MidiPerfoSeq trace: %u records dropped\n", dropped);
+            std::fflush(out);
+            if (running) d_msleep(20);
+        }
+        if (file != nullptr) std::fclose(file);
+    }
+
+    static void printTraceRecord(std::FILE* out, const TraceRecord& record)
+    {
+        const unsigned long long time = record.time;
+        switch (record.kind)
+        {
+            case traceBlock:
+                std::fprintf(out, "%llu block frames %d events %d run %u ns\n", time, record.a, record.b, record.c);
+                break;
+            case traceState:
+                std::fprintf(out, "%llu lane %d state %d -> %d\n", time, record.lane, record.a, record.b);
+                break;
+            case traceStep:
+                std::fprintf(out, "%llu lane %d step %d cursor %d\n", time, record.lane, record.a, record.b);
+                break;
+            case traceEvent:
+                std::fprintf(out, "%llu event %02x %02x %02x\n", time, record.data[0], record.data[1], record.data[2]);
+                break;
+            default:
+                break;
+        }
+    }
+#endif
+
+    /*
+     * Input events passed to the output. Passed notes are tracked, so their
+     * note off can't get lost when the sequencer changes its mode in between.
+     */
+    void forwardEvent(const MidiEvent& event)
+    {
+        const uint8_t channel = event.data[0] & 0x0F;
+        const uint8_t note = event.data[1] & 0x7F;
+        switch (event.data[0] & 0xF0)
+        {
+            case 0x90:
+                thruNotes.noteOn(channel, note);
+                break;
+            case 0x80:
+                thruNotes.noteOff(channel, note);
                 break;
+            default:
+                break;
+        }
+        passMidiEvent(event);
+    }
+
+    /*
+     * Generated notes go through these two, so every note on is tracked
+     * and its note off is sent for exactly the pitch which was switched on.
+     */
+    void sendNoteOn(uint32_t frame, uint8_t channel, uint8_t note, uint8_t velocity)
+    {
+        MidiEvent me;
+        me.frame = frame;
+        me.size = 3;
+        me.data[0] = uint8_t(0x90 + (channel & 0x0F));
+        me.data[1] = note;
+        me.data[2] = velocity;
+        me.data[3] = 0;
+        me.dataExt = nullptr;
+        emitMidiEvent(me);
+        activeNotes.noteOn(channel, note);
+    }
+
+    void sendNoteOff(uint32_t frame, uint8_t channel, uint8_t note, uint8_t velocity)
+    {
+        if (! activeNotes.isOn(channel, note)) return;  // already released
+        MidiEvent me;
+        me.frame = frame;
+        me.size = 3;
+        me.data[0] = uint8_t(0x80 + (channel & 0x0F));
+        me.data[1] = note;
+        me.data[2] = velocity;
+        me.data[3] = 0;
+        me.dataExt = nullptr;
+        emitMidiEvent(me);
+        activeNotes.noteOff(channel, note);
+    }
+
+    /*
+     * Releases the chord started by the keys of a lane with exactly the pitches
+     * it was started with, whatever the transposition is now, and the pads it plays.
+     */
+    void releaseHeldNotes(SequencerLane& lane, uint32_t frame)
+    {
+        releaseChord(lane, frame);
+        while (lane.padVoiceCount > 0) releasePadVoice(lane, lane.padVoiceCount-1, frame);
+    }
+
+    /*
+     * Releases only the chord of a lane with its repeats and strum, not its pads.
+     */
+    void releaseChord(SequencerLane& lane, uint32_t frame)
+    {
+        for (int i=0;i<lane.heldNoteCount;i++)
+        {
+            const HeldNote& held(lane.heldNotes[i]);
+            sendNoteOff(uint32_t(frame+i), held.channel, held.note, held.velocity);
+        }
+        lane.heldNoteCount = 0;
+        lane.ratchet.remaining = 0;
+        lane.strum.cancel();
+    }
+
+    /*
+     * Key pad mode: key base+n plays step n, other keys have no step.
+     * Rebuilt on first use after the pattern or the base key changed.
+     */
+    void rebuildKeySteps(SequencerLane& lane)
+    {
+        for (int key=0;key<128;key++)
+        {
+            const int step = key - transposeBaseKey;
+            lane.keySteps[key] = (step >= 0 && step < lane.pattern->size()) ? uint8_t(step) : KEY_STEP_NONE;
+        }
+        lane.keyStepsDirty = false;
+    }
+
+    /*
+     * Key pad mode: a note on of the lane in play mode starts the notes of its step at once,
+     * they end with the release of the key (releasePadKey()), whatever the other keys do.
+     * The cost doesn't depend on the pattern length. Keys without a step pass through.
+     */
+    void playPadKey(SequencerLane& lane, const MidiEvent& event)
+    {
+        const uint8_t channel = event.data[0] & 0x0F;
+        const uint8_t key = event.data[1] & 0x7F;
+        if (lane.keyStepsDirty) rebuildKeySteps(lane);
+        const uint8_t step = lane.keySteps[key];
+        if (step == KEY_STEP_NONE)
+        {
+            forwardEvent(event);
+            return;
+        }
+        // a key pressed again restarts its step, the oldest key makes room when all voices sound
+        for (int i=0;i<lane.padVoiceCount;i++)
+        {
+            if (lane.padVoices[i].channel != channel || lane.padVoices[i].key != key) continue;
+            releasePadVoice(lane, i, event.frame);
+            break;
+        }
+        if (lane.padVoiceCount == MAX_PAD_VOICES) releasePadVoice(lane, 0, event.frame);
+        PadVoice& voice(lane.padVoices[lane.padVoiceCount++]);
+        voice.channel = channel;
+        voice.key = key;
+        const PatternNote* notes = lane.pattern->stepNotes(step);
+        voice.noteCount = lane.pattern->stepLength(step);
+        for (int i=0;i<voice.noteCount;i++)
+        {
+            HeldNote& held(voice.notes[i]);
+            held.channel = notes[i].status & 0x0F;
+            held.note = pitchTable.at(notes[i].note, transposeSemiNotes);
+            held.velocity = notes[i].velocity;
+            sendNoteOn(event.frame, held.channel, held.note, held.velocity);
+        }
+        lane.sequencerIndex = step;
+    }
+
+    /*
+     * The release of a key which may have started a pad voice.
+     */
+    void releasePadKey(SequencerLane& lane, const MidiEvent& event)
+    {
+        const uint8_t channel = event.data[0] & 0x0F;
+        const uint8_t key = event.data[1] & 0x7F;
+        for (int i=0;i<lane.padVoiceCount;i++)
+        {
+            if (lane.padVoices[i].channel != channel || lane.padVoices[i].key != key) continue;
+            releasePadVoice(lane, i, event.frame);
+            return;
+        }
+    }
+
+    /*
+     * Ends the notes of a pad voice, the later voices move up.
+     */
+    void releasePadVoice(SequencerLane& lane, int index, uint32_t frame)
+    {
+        const PadVoice& voice(lane.padVoices[index]);
+        for (int i=0;i<voice.noteCount;i++)
+            sendNoteOff(frame, voice.notes[i].channel, voice.notes[i].note, voice.notes[i].velocity);
+        for (int i=index+1;i<lane.padVoiceCount;i++) lane.padVoices[i-1] = lane.padVoices[i];
+        lane.padVoiceCount -= 1;
+    }
+
+    /*
+     * Sequencer output of the lane is active (play state or a request coming from it)
+     */
+    bool isPlayState(const SequencerLane& lane) const
+    {
+        // an overdubbing lane keeps playing the slot it records into a copy of
+        return lane.eventMode == eventsPlay || (lane.eventMode == eventsRecord && lane.overdubSlot >= 0);
+    }
+
+    /*
+     * Actual transposition of the lane in semitones
+     */
+    int getTransposeNote(const SequencerLane& lane) const
+    {
+        if (transposeOnKeys == 1) return lane.lastNoteOnEvent.data[1] - transposeBaseKey + transposeSemiNotes;
+        return transposeSemiNotes;
+    }
+
+    /*
+     * Reads the host transport at the start of a block: the tempo, and in host clock
+     * mode the first clocked step of this block. Steps are counted as multiples of the rate
+     * from the song start, so they stay aligned across blocks of any size.
+     */
+    void prepareClock()
+    {
+        clockNextFrame = -1.0;
+        const TimePosition& timePosition(getTimePosition());
+        const bool musicalTime = timePosition.bbt.valid && timePosition.bbt.beatsPerMinute > 0.0
+                              && timePosition.bbt.beatType > 0.0f && timePosition.bbt.ticksPerBeat > 0.0;
+        // without musical time the host is taken to run at 120 bpm
+        const double quartersPerBeat = musicalTime ? 4.0 / timePosition.bbt.beatType : 1.0;
+        framesPerQuarter = musicalTime ? getSampleRate() * 60.0 / timePosition.bbt.beatsPerMinute / quartersPerBeat
+                                       : getSampleRate() * 0.5;
+        const bool transportStopped = hostTransportPlaying && ! timePosition.playing;
+        hostTransportPlaying = timePosition.playing;
+        if (stepClockMode == clockMidi)
+        {
+            prepareMidiClock();
+            return;
+        }
+        if (stepClockMode != clockHost) return;
+        if (! timePosition.playing)
+        {
+            clockTickValid = false;
+            if (transportStopped) stopLanes(currentFrame);
+            return;
+        }
+
+        double quarterPos;
+        if (musicalTime)
+        {
+            const double beats = (timePosition.bbt.bar-1) * double(timePosition.bbt.beatsPerBar)
+                               + (timePosition.bbt.beat-1)
+                               + timePosition.bbt.tick / timePosition.bbt.ticksPerBeat;
+            quarterPos = beats * quartersPerBeat;
+        }
+        else
+        {
+            // transport without musical time, count from its frame position
+            quarterPos = double(timePosition.frame) / framesPerQuarter;
+        }
+
+        const double stepQuarters = kClockRateQuarters[stepClockRate];
+        int64_t tick = int64_t(std::ceil(quarterPos / stepQuarters - 1e-9));
+        // the step may already have been fired at the end of the previous block
+        if (clockTickValid && tick == clockTick-1) tick = clockTick;
+        clockTick = tick;
+        clockFramesPerStep = stepQuarters * framesPerQuarter;
+        clockNextFrame = (double(tick) * stepQuarters - quarterPos) * framesPerQuarter;
+        if (clockNextFrame < 0.0) clockNextFrame = 0.0;
+    }
+
+    /*
+     * The clock stopped, by a midi stop or the host transport in host clock mode:
+     * no step is due any more, the chords of the lanes end with their repeats and strums.
+     */
+    void stopLanes(uint32_t frame)
+    {
+        clockNextFrame = -1.0;
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++) releaseChord(lanes[i], frame);
+    }
+
+    /*
+     * A midi start: every lane goes back to its first step, with the step order of the
+     * settings of now and the random order of its seed.
+     */
+    void rewindLanes()
+    {
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            SequencerLane& lane(lanes[i]);
+            lane.sequencerIndex = 0;
+            lane.stepOrderCursor = 0;
+            lane.stepOrderDirty = true;
+            lane.random.seed(uint32_t(randomSeed));
+        }
+    }
+
+    /*
+     * The clock settings changed at a frame within the block (a learned controller):
+     * the steps from that frame on follow them as if the block started there.
+     */
+    void restartClock(uint32_t frame)
+    {
+        prepareClock();
+        if (stepClockMode != clockHost || clockNextFrame < 0.0) return;
+        while (uint32_t(clockNextFrame + 1e-6) < frame)
+        {
+            clockNextFrame += clockFramesPerStep;
+            clockTick += 1;
+        }
+    }
+
+    /*
+     * Sends due scheduled events, strummed notes, note repeats and clocked steps
+     * in frame order until the given frame.
+     * Of events at the same time the scheduled note offs go first, then the rest
+     * of a strum, then the next step and last the repeats.
+     * Returns the time of the first one which is still to come.
+     */
+    uint64_t advanceClock(uint32_t untilFrame)
+    {
+        for (;;)
+        {
+            const uint32_t tickFrame = uint32_t(clockNextFrame + 1e-6);
+            const uint64_t tickTime = clockNextFrame >= 0.0 ? blockStartTime + tickFrame : UINT64_MAX;
+            const uint64_t eventTime = scheduler.empty() ? UINT64_MAX : scheduler.nextTime();
+            SequencerLane* const strumLane = nextStrum();
+            const uint64_t strumTime = strumLane != nullptr ? strumLane->strum.times[strumLane->strum.next] : UINT64_MAX;
+            SequencerLane* const ratchetLane = nextRatchet();
+            const uint64_t ratchetTime = ratchetLane != nullptr ? ratchetLane->ratchet.hitTime() : UINT64_MAX;
+            const uint64_t dueTime = std::min(std::min(tickTime, eventTime), std::min(strumTime, ratchetTime));
+            if (dueTime >= blockStartTime + untilFrame) return dueTime;
+            if (eventTime == dueTime)
+            {
+                const ScheduledEvent& event(scheduler.top());
+                const uint32_t frame = event.time > blockStartTime ? uint32_t(event.time - blockStartTime) : 0;
+                if ((event.data[0] & 0xF0) == 0x80)
+                {
+                    sendNoteOff(frame, event.data[0] & 0x0F, event.data[1], event.data[2]);
+                }
+                else
+                {
+                    MidiEvent me;
+                    me.frame = frame;
+                    me.size = event.size;
+                    for (int i=0;i<3;i++) me.data[i] = event.data[i];
+                    me.data[3] = 0;
+                    me.dataExt = nullptr;
+                    emitMidiEvent(me);
+                }
+                lastScheduledTime = event.time;
+                scheduler.pop();
             }
-            case 5:  // random
+            else if (strumTime == dueTime)
             {
-                noteOnQueueVectorIndex = rand() % noteOnQueueVector.size();
-                break;
+                fireStrum(*strumLane);
+            }
+            else if (tickTime == dueTime)
+            {
+                currentFrame = tickFrame;
+                fireClockStep(tickFrame);
+                clockTickValid = true;
+                clockTick += 1;
+                if (stepClockMode == clockMidi)
+                {
+                    // the next step waits for its clock
+                    midiStepTime = -1.0;
+                    clockNextFrame = -1.0;
+                }
+                else
+                {
+                    clockNextFrame += clockFramesPerStep;
+                }
+            }
+            else
+            {
+                fireRatchet(*ratchetLane);
             }
-            case 6:  // random
+        }
+    }
+
+    /*
+     * One clocked step: every lane with held keys plays its current chord
+     * for the gate length and advances.
+     */
+    void fireClockStep(uint32_t frame)
+    {
+        uint64_t gateFrames = uint64_t(clockFramesPerStep * stepGateLength / 100.0);
+        if (gateFrames < 1) gateFrames = 1;
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++) fireLaneStep(lanes[i], frame, gateFrames);
+    }
+
+    /*
+     * Midi clock mode: the tempo of the clock input, and a step which is due in this block.
+     */
+    void prepareMidiClock()
+    {
+        if (midiClockTracker.locked()) framesPerQuarter = midiClockTracker.framesPerClock() * MIDI_CLOCKS_PER_QUARTER;
+        clockFramesPerStep = kClockRateQuarters[stepClockRate] * framesPerQuarter;
+        if (midiStepTime >= 0.0)
+            clockNextFrame = std::max(0.0, midiStepTime - double(blockStartTime));
+    }
+
+    /*
+     * A midi realtime message at the current frame. Clocks are counted from the last start,
+     * every one which begins a step plays it at the smoothed clock time. A clock which came
+     * late gets its step back dated within the block, but not before scheduled events which
+     * were already sent (the note offs of the previous step). Start rewinds the lanes to their first step,
+     * stop stops them like the host transport does (stopLanes()), continue goes on counting.
+     * Only used in midi clock mode, the messages are passed through anyway.
+     */
+    void handleMidiClock(uint8_t status)
+    {
+        const uint64_t now = blockStartTime + currentFrame;
+        switch (status)
+        {
+            case 0xF8:
             {
-                noteOnQueueVectorIndex = rand() % noteOnQueueVector.size();
+                const double smoothed = midiClockTracker.clock(now, framesPerQuarter / MIDI_CLOCKS_PER_QUARTER);
+                if (! midiClockRunning) break;
+                const int64_t clocksPerStep = std::max<int64_t>(1, std::lround(kClockRateQuarters[stepClockRate] * MIDI_CLOCKS_PER_QUARTER));
+                if (midiClockCount % clocksPerStep == 0)
+                {
+                    midiStepTime = std::max(smoothed, double(std::max(blockStartTime, lastScheduledTime)));
+                    clockNextFrame = midiStepTime - double(blockStartTime);
+                }
+                midiClockCount += 1;
                 break;
             }
+            case 0xFA:
+                midiClockRunning = true;
+                midiClockCount = 0;
+                rewindLanes();
+                break;
+            case 0xFB:
+                midiClockRunning = true;
+                break;
+            case 0xFC:
+                midiClockRunning = false;
+                midiStepTime = -1.0;
+                stopLanes(currentFrame);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /*
+     * Runs only while the lane plays and keys are held.
+     */
+    void fireLaneStep(SequencerLane& lane, uint32_t frame, uint64_t gateFrames)
+    {
+        switchToSelectedSlot(lane);
+        if (! isPlayState(lane) || lane.pattern->empty() || lane.activeNoteOnCount == 0) return;
+        const int transposeNote = getTransposeNote(lane);
+        const int sindex = getSequencerIndex(lane);
+        const PatternNote* notes = lane.pattern->stepNotes(sindex);
+        const int count = lane.pattern->stepLength(sindex);
+        HeldNote chord[MAX_NOTES_PER_STEP];
+        for (int i=0;i<count;i++)
+        {
+            chord[i].channel = notes[i].status & 0x0F;
+            chord[i].note = pitchTable.at(notes[i].note, transposeNote);
+            chord[i].velocity = notes[i].velocity;
+        }
+        startStrum(lane, frame, notes, chord, count, gateFrames);
+        // the repeats stay within the gate, its scheduled note offs end them
+        startRatchet(lane, frame, chord, count, blockStartTime + frame + gateFrames);
+        getNextSequencerIndex(lane);
+    }
+
+    /*
+     * Plays the notes of a step starting at the given frame, each at its recorded onset
+     * offset scaled to the host tempo and by the strum setting. Notes with no offset
+     * start right away, the later ones follow while time passes, see advanceClock().
+     * A gate of 0 leaves the notes to releaseHeldNotes(), otherwise every note gets its
+     * note off scheduled the gate after its own onset.
+     */
+    void startStrum(SequencerLane& lane, uint32_t frame, const PatternNote* notes, const HeldNote* chord, int count, uint64_t gate)
+    {
+        Strum& strum(lane.strum);
+        strum.cancel();
+        strum.gate = gate;
+        const double framesPerTick = framesPerQuarter * strumPercent / (100.0 * PATTERN_TICKS_PER_QUARTER);
+        const uint64_t startTime = blockStartTime + frame;
+        for (int i=0;i<count;i++)
+        {
+            strum.notes[i] = chord[i];
+            strum.times[i] = startTime + uint64_t(notes[i].offset * framesPerTick + 0.5);
+            // offsets of an imported or overfull step may go back, the onsets are fired in order
+            if (i > 0 && strum.times[i] < strum.times[i-1]) strum.times[i] = strum.times[i-1];
+        }
+        strum.count = count;
+        while (strum.pending() && strum.times[strum.next] <= startTime) fireStrum(lane);
+    }
+
+    /*
+     * The lane whose next strummed note comes first, nullptr when no notes are pending.
+     */
+    SequencerLane* nextStrum()
+    {
+        SequencerLane* next = nullptr;
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            const Strum& strum(lanes[i].strum);
+            if (! strum.pending()) continue;
+            if (next == nullptr || strum.times[strum.next] < next->strum.times[next->strum.next]) next = &lanes[i];
+        }
+        return next;
+    }
+
+    /*
+     * Starts the next note of a strum.
+     */
+    void fireStrum(SequencerLane& lane)
+    {
+        Strum& strum(lane.strum);
+        const HeldNote& held(strum.notes[strum.next]);
+        const uint64_t time = strum.times[strum.next];
+        const uint32_t frame = time > blockStartTime ? uint32_t(time - blockStartTime) : 0;
+        strum.next += 1;
+        sendNoteOn(frame, held.channel, held.note, held.velocity);
+        if (strum.gate == 0) return;
+        const uint8_t noteOff[3] = { uint8_t(0x80 + held.channel), held.note, held.velocity };
+        if (! scheduler.push(time + strum.gate, noteOff, 3))
+            sendNoteOff(frame, held.channel, held.note, held.velocity);  // no room left, end the note right away
+    }
+
+    /*
+     * Starts the note repeats of a step which was played at the given frame.
+     * The hits follow while time passes, see advanceClock().
+     */
+    void startRatchet(SequencerLane& lane, uint32_t frame, const HeldNote* notes, int count, uint64_t endTime)
+    {
+        Ratchet& ratchet(lane.ratchet);
+        ratchet.remaining = 0;
+        if (ratchetHits < 2 || count == 0) return;
+        ratchet.interval = kClockRateQuarters[ratchetRateIndex] * framesPerQuarter;
+        if (ratchet.interval < 1.0) ratchet.interval = 1.0;
+        ratchet.nextTime = double(blockStartTime + frame) + ratchet.interval;
+        ratchet.endTime = endTime;
+        ratchet.remaining = ratchetHits - 1;
+        ratchet.velocityScale = 1.0f;
+        ratchet.noteCount = count;
+        for (int i=0;i<count;i++) ratchet.notes[i] = notes[i];
+    }
+
+    /*
+     * The lane whose next repeat comes first, nullptr when no lane repeats.
+     */
+    SequencerLane* nextRatchet()
+    {
+        SequencerLane* next = nullptr;
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++)
+        {
+            const Ratchet& ratchet(lanes[i].ratchet);
+            if (ratchet.remaining == 0) continue;
+            if (next == nullptr || ratchet.nextTime < next->ratchet.nextTime) next = &lanes[i];
+        }
+        return next;
+    }
+
+    /*
+     * One repeat: the notes of the step which still sound start again with decayed velocity.
+     * Notes ended meanwhile stay off, so a repeat never leaves a note without its note off.
+     */
+    void fireRatchet(SequencerLane& lane)
+    {
+        Ratchet& ratchet(lane.ratchet);
+        const uint64_t time = ratchet.hitTime();
+        if (time >= ratchet.endTime)
+        {
+            ratchet.remaining = 0;
+            return;
+        }
+        const uint32_t frame = time > blockStartTime ? uint32_t(time - blockStartTime) : 0;
+        ratchet.velocityScale *= 1.0f - ratchetDecayPercent / 100.0f;
+        for (int i=0;i<ratchet.noteCount;i++)
+        {
+            const HeldNote& held(ratchet.notes[i]);
+            if (! activeNotes.isOn(held.channel, held.note)) continue;
+            long velocity = std::lround(held.velocity * ratchet.velocityScale);
+            if (velocity < 1) velocity = 1;
+            sendNoteOff(frame, held.channel, held.note, held.velocity);
+            sendNoteOn(frame, held.channel, held.note, uint8_t(velocity));
+        }
+        ratchet.remaining -= 1;
+        ratchet.nextTime += ratchet.interval;
+    }
+
+    /*
+     * Events which neither drive nor change a lane: aftertouch, pitch bend, controllers
+     * which aren't bound or being learned and system messages other than a clock input
+     * in use. Notes, program changes and long (sysex) events take the full path.
+     */
+    bool isControllerData(const MidiEvent& event) const
+    {
+        if (event.size > event.kDataSize) return false;
+        switch (event.data[0] & 0xF0)
+        {
+            case 0xA0:
+            case 0xD0:
+            case 0xE0:
+                return true;
+            case 0xB0:
+                return learnTargetValue == learnOff && learnMap.target(event.data[0] & 0x0F, event.data[1]) < 0;
+            case 0xF0:
+                return stepClockMode != clockMidi || event.data[0] < 0xF8;
+            default:
+                return false;
+        }
+    }
+
+    /*
+     * Forwards the run of controller data which starts at index, returns the index of
+     * its last event. Every event goes out when its lane passes events, as on the full path,
+     * but the lane states can't change within the run: only the generated events which
+     * become due in between are looked after.
+     * Each event costs a lane lookup and a write to the host.
+     */
+    uint32_t forwardControllerRun(const MidiEvent* events, uint32_t count, uint32_t index)
+    {
+        uint64_t dueTime = advanceClock(events[index].frame);
+        for (;;)
+        {
+            const MidiEvent& event(events[index]);
+            if (dueTime < blockStartTime + event.frame) dueTime = advanceClock(event.frame);
+            currentFrame = event.frame;
+            if (lanes[dispatchLane(event)].eventMode != eventsIdle) passMidiEvent(event);
+            if (index + 1 >= count || ! isControllerData(events[index+1])) return index;
+            index += 1;
+        }
+    }
+
+    /*
+     * Learns the controller of a control change event or sets the parameter it is bound to.
+     * Returns true when the event is filtered from the output.
+     */
+    bool handleControlChange(const MidiEvent& event)
+    {
+        const uint8_t channel = event.data[0] & 0x0F;
+        const uint8_t controller = event.data[1] & 0x7F;
+        if (learnTargetValue == learnForget)
+            learnMap.forget(channel, controller);
+        else if (learnTargetValue >= learnFirstParameter)
+            learnMap.bind(channel, controller, learnTargetValue - learnFirstParameter);
+        const int index = learnMap.target(channel, controller);
+        if (index < 0) return false;
+
+        // the controller range covers the parameter range, switches turn on from the middle
+        const ParameterRanges& ranges(controlRanges[index]);
+        const uint32_t hints = controlHints[index];
+        float value = ranges.min + (ranges.max - ranges.min) * (event.data[2] & 0x7F) / 127.0f;
+        if (hints & kParameterIsBoolean)
+            value = (event.data[2] & 0x7F) >= 64 ? ranges.max : ranges.min;
+        else if (hints & kParameterIsInteger)
+            value = std::round(value);
+        // reported back to the host, its next write of this parameter applies on top of it
+        appliedParameters[index] = value;
+        parameterApplied[index] = true;
+        parameters.report(uint32_t(index), value);
+        applyParameterValue(uint32_t(index), value);
+        if (index == clockMode || index == clockRate) restartClock(event.frame);
+        if (laneMapDirty) rebuildLaneMap();
+        for (int i=0;i<MAX_SEQUENCER_LANES;i++) updateMachineState(lanes[i]);
+        return learnFilterOn;
+    }
+
+    /*
+     * Applies the parameters the host changed since the last block, the others keep
+     * the values run() works with. All events of a block see the same parameter set.
+     */
+    void fetchParameters()
+    {
+        float snapshot[parameterCount];
+        bool changed[parameterCount];
+        if (! parameters.fetch(snapshot, changed)) return;
+        for (int i=0;i<parameterCount;i++)
+        {
+            if (! changed[i] || (parameterApplied[i] && snapshot[i] == appliedParameters[i])) continue;
+            appliedParameters[i] = snapshot[i];
+            parameterApplied[i] = true;
+            applyParameterValue(uint32_t(i), snapshot[i]);
         }
-        noteOnQueueVectorIndex %= noteOnQueueVector.size();
-        return noteOnQueueVectorIndex;
+        if (laneMapDirty) rebuildLaneMap();
     }
 
     /*
-     * Returns the actual index in the noteOnQueueVector
+     * The events of a block from the given one on, for one keypress action: what the action
+     * decides per event is known at compile time. Returns where a learned controller changed
+     * the action, run() goes on there in the loop of the new action.
      */
-    int getSequencerIndex()
+    template <int Action>
+    uint32_t processEvents(const MidiEvent* midiEvents, uint32_t midiEventCount, uint32_t first)
     {
-        return noteOnQueueVectorIndex;
+        for (uint32_t i=first; i<midiEventCount; ++i)
+        {
+            // controller floods take the short way
+            if (isControllerData(midiEvents[i]))
+            {
+                i = forwardControllerRun(midiEvents, midiEventCount, i);
+                continue;
+            }
+            MidiEvent midiEvent = midiEvents[i];
+            advanceClock(midiEvent.frame);
+            currentFrame = midiEvent.frame;
+            if (midiEvent.size <= midiEvent.kDataSize)
+            {
+                // a note on with velocity 0 is a note off, for counting, recording and dispatching too
+                if (((midiEvent.data[0] & 0xF0) == 0x90) && midiEvent.data[2] == 0) midiEvent.data[0] = (midiEvent.data[0] & 0x0F) + 0x80;
+                if (stepClockMode == clockMidi && midiEvent.size == 1 && midiEvent.data[0] >= 0xF8)
+                {
+                    handleMidiClock(midiEvent.data[0]);
+                    // a step dated back by the clock goes out ahead of the clock itself
+                    advanceClock(midiEvent.frame + 1);
+                }
+                // learned controllers set their parameter at the frame of the event,
+                // a changed keypress action goes on in its own loop with the next event
+                if (((midiEvent.data[0] & 0xF0) == 0xB0) && handleControlChange(midiEvent))
+                {
+                    if (transposeOnKeys != Action) return i + 1;
+                    continue;
+                }
+                // only the lane of the event is looked at
+                const int laneIndex = dispatchLane(midiEvent);
+                SequencerLane& lane(lanes[laneIndex]);
+                int& activeNoteOnCount(lane.activeNoteOnCount);
+                // a program change selects a slot, forwarded like any other event
+                if ((midiEvent.data[0] & 0xF0) == 0xC0 && midiEvent.data[1] < MAX_PATTERN_SLOTS)
+                    lane.selectedSlot = midiEvent.data[1];
+                // no key held: a new step starts with the next key
+                if (activeNoteOnCount == 0) switchToSelectedSlot(lane);
+                PatternStore* const pattern = lane.pattern;
+                // Count the activeNoteOnEvents and remeber last played Note
+                switch (midiEvent.data[0] & 0xF0)
+                {
+                    case 0x80:
+                    {
+                        // only keys which were counted when pressed are counted down,
+                        // so a change of the keypress action can't leave the count behind
+                        const uint8_t channel = midiEvent.data[0] & 0x0F;
+                        const uint8_t key = midiEvent.data[1] & 0x7F;
+                        if (lane.heldKeys.isOn(channel, key))
+                        {
+                            lane.heldKeys.noteOff(channel, key);
+                            activeNoteOnCount -= 1;
+                        }
+                        break;
+
+                    }
+                    case 0x90:
+                    {
+                        if (activeNoteOnCount == 0) lane.lastNoteOnEvent = midiEvent;
+                        displayLane = laneIndex;
+                        const uint8_t channel = midiEvent.data[0] & 0x0F;
+                        const uint8_t key = midiEvent.data[1] & 0x7F;
+                        if ((Action != 2 || key == transposeBaseKey) && ! lane.heldKeys.isOn(channel, key))
+                        {
+                            lane.heldKeys.noteOn(channel, key);
+                            activeNoteOnCount += 1;
+                        }
+                        break;
+                    }
+                    default:
+                        break;
+                }
+                if (activeNoteOnCount < 0) activeNoteOnCount = 0;
+                // calculate transpose value
+                const int transposeNote = Action == 1 ? lane.lastNoteOnEvent.data[1] - transposeBaseKey + transposeSemiNotes
+                                                      : transposeSemiNotes;
+
+                // playing notes until no key is pressed
+                int playMode = isPlayState(lane) && (pattern->size() > 0);
+                // a pad ends with its key, whatever the state and the mode are now
+                if (((midiEvent.data[0] & 0xF0) == 0x80) && lane.padVoiceCount > 0) releasePadKey(lane, midiEvent);
+                // so does a chord with the last key, when the lane stopped playing or its slot was emptied meanwhile
+                if (((midiEvent.data[0] & 0xF0) == 0x80) && ! playMode && activeNoteOnCount == 0 && lane.heldNoteCount > 0)
+                    releaseChord(lane, midiEvent.frame);
+                if (playMode && stepClockMode == clockPads && ((midiEvent.data[0] & 0xE0) == 0x80))
+                {
+                    if ((midiEvent.data[0] & 0xF0) == 0x90) playPadKey(lane, midiEvent);
+                    // a chord started before the switch to pads ends with the last key,
+                    // the pads keep sounding until their own keys go up
+                    else if (activeNoteOnCount == 0 && lane.heldNoteCount > 0) releaseChord(lane, midiEvent.frame);
+                }
+                else if (playMode)
+                {
+                    switch (midiEvent.data[0] & 0xF0)
+                    {
+                        case 0x80:
+                        {
+                            if ((pattern->size()>0) && (activeNoteOnCount == 0))
+                            {
+                                releaseHeldNotes(lane, midiEvent.frame);
+                                if (stepClockMode == clockKeys) getNextSequencerIndex(lane);
+                            }
+                            break;
+                        }
+                        case 0x90:
+                        {
+                            if (activeNoteOnCount == 1 && stepClockMode == clockKeys)
+                            {
+                                if (pattern->size()>0)
+                                {
+                                    const int sindex = getSequencerIndex(lane);
+                                    const PatternNote* notes = pattern->stepNotes(sindex);
+                                    const int count = pattern->stepLength(sindex);
+                                    releaseHeldNotes(lane, midiEvent.frame);
+                                    for (int i=0;i<count;i++)
+                                    {
+                                        HeldNote& held = lane.heldNotes[lane.heldNoteCount++];
+                                        held.channel = notes[i].status & 0x0F;
+                                        held.note = pitchTable.at(notes[i].note, transposeNote);
+                                        held.velocity = notes[i].velocity;
+                                    }
+                                    startStrum(lane, midiEvent.frame, notes, lane.heldNotes, lane.heldNoteCount, 0);
+                                    // repeated until the key release
+                                    startRatchet(lane, midiEvent.frame, lane.heldNotes, lane.heldNoteCount, UINT64_MAX);
+                                }
+                            }
+                            break;
+                        }
+                        default:
+                            forwardEvent(midiEvent);
+                            break;
+                    }
+
+                }
+
+                // through all midi events, when no notes are in the queue array.
+                int throughMode = isPlayState(lane) && (pattern->size() == 0);
+                if (throughMode)
+                {
+                    forwardEvent(midiEvent);
+                }
+
+                // recording notes until state logic isn't satisfied
+                int recMode = lane.eventMode == eventsRecord;
+                if (recMode)
+                {
+                    switch (midiEvent.data[0] & 0xF0)
+                    {
+                        case 0x90:
+                        {
+                            PatternStore* const recorded = lane.overdubSlot >= 0 ? lane.overdubStore : slots[lane.selectedSlot];
+                            beginPatternChange();
+                            const uint64_t noteTime = blockStartTime + midiEvent.frame;
+                            if (activeNoteOnCount == 1)
+                            {
+                                lane.recordStepTime = noteTime;
+                                lane.recordStep = -1;
+                                // overdubbing in place: the chord replaces the step the lane is at
+                                if (replaceStepsOn && lane.overdubSlot >= 0 && lane.sequencerIndex < recorded->size())
+                                {
+                                    lane.recordStep = lane.sequencerIndex;
+                                    recorded->clearStep(lane.recordStep);
+                                    patternChanged(recorded, false);
+                                }
+                                else if (recorded->appendStep()) patternChanged(recorded, false);
+                            }
+                            // the onset within the chord, in ticks of the tempo it is played at
+                            const double offset = (noteTime - lane.recordStepTime) * PATTERN_TICKS_PER_QUARTER / framesPerQuarter;
+                            const PatternNote note = { midiEvent.data[0], midiEvent.data[1], midiEvent.data[2],
+                                                       uint16_t(std::min(offset + 0.5, 65535.0)) };
+                            if (lane.recordStep >= 0)
+                                recorded->insertNote(lane.recordStep, note);
+                            else
+                                recorded->appendNote(note);
+                            endPatternChange();
+
+                            break;
+
+                        }
+                    }
+                    // an overdubbing lane is heard through its playing
+                    if (lane.overdubSlot < 0) forwardEvent(midiEvent);
+
+                }
+                // a key which went through gets its release through, whatever the mode is now
+                if (((midiEvent.data[0] & 0xF0) == 0x80) && thruNotes.isOn(midiEvent.data[0] & 0x0F, midiEvent.data[1] & 0x7F))
+                    forwardEvent(midiEvent);
+                // state transitions caused by this event take effect at its frame
+                updateMachineState(lane);
+                if (((midiEvent.data[0] & 0xF0) == 0xB0) && transposeOnKeys != Action) return i + 1;
+            }
+        }
+        return midiEventCount;
     }
 
+    typedef uint32_t (MidiPerfoSeqPlugin::*EventLoop)(const MidiEvent*, uint32_t, uint32_t);
+    static constexpr EventLoop kEventLoops[3] = {
+        &MidiPerfoSeqPlugin::processEvents<0>, &MidiPerfoSeqPlugin::processEvents<1>, &MidiPerfoSeqPlugin::processEvents<2>
+    };
 
     /**
      *  Run/process function for plugins with MIDI input.
      *  The logic is a state machine, which is triggered by the lv2 parameter settings.
      */
-    void run(const float**, float**, uint32_t,
+    void run(const float**, float**, uint32_t frames,
              const MidiEvent* midiEvents, uint32_t midiEventCount) override
              {
-                 for (uint32_t i=0; i<midiEventCount; ++i)
+#ifdef MIDIPERFOSEQ_RT_ALLOC_GUARD
+                 const RtAllocScope rtAllocScope;
+#endif
+#if defined(MIDIPERFOSEQ_BLOCK_STATS) || defined(MIDIPERFOSEQ_TRACE)
+                 const std::chrono::steady_clock::time_point blockStart = std::chrono::steady_clock::now();
+#endif
+                 currentFrame = 0;
+                 fetchParameters();
+                 takeRestoredSlots();
+                 for (int i=0;i<MAX_SEQUENCER_LANES;i++)
                  {
-                     MidiEvent midiEvent = midiEvents[i];
-                     if (midiEvent.size <= midiEvent.kDataSize)
-                     {
-                         // Count the activeNoteOnEvents and remeber last played Note
-                         switch (midiEvent.data[0] & 0xF0)
-                         {
-                             case 0x80:
-                             {
-                                 if (transposeOnKeys == 2)
-                                 {
-                                     if ((midiEvent.data[1] & 0x7F) == transposeBaseKey)
-                                         activeNoteOnCount -= 1;
-                                 }
-                                 else
-                                 {
-                                     activeNoteOnCount -= 1;
-                                 }
-                                 break;
-
-                             }
-                             case 0x90:
-                             {
-                                 if (activeNoteOnCount == 0) lastNoteOnEvent = midiEvent;
-                                 if (transposeOnKeys == 2)
-                                 {
-                                     if ((midiEvent.data[1] & 0x7F) == transposeBaseKey)
-                                         activeNoteOnCount += 1;
-                                 }
-                                 else
-                                 {
-                                     activeNoteOnCount += 1;
-                                 }
-                                 break;
-                             default:
-                                 break;
-                             }
-                         }
-                         if (activeNoteOnCount < 0) activeNoteOnCount = 0;
-                         // calculate transpose value
-                         int transposeNote=transposeSemiNotes;
-                         if (transposeOnKeys == 1)
-                         {
-                             transposeNote = lastNoteOnEvent.data[1] - transposeBaseKey + transposeSemiNotes;
-                         }
-
-                         //std::cout << "machineState: " << machineState << "\n";
-                         //std::cout << "lastMachineState: " << lastMachineState << "\n";
-                         //std::cout << "Tastenanzahl: " << activeNoteOnCount << "\n";
-                         // std::cout << "Last Note On: " << int(lastNoteOnEvent.data[1]) << "\n";
-                         // std::cout << "Semi Transpose: " << transposeSemiNotes << "\n";
-                         // std::cout << "Key Transpose ONOFF: " << transposeOnKeys << "\n";
-                         // std::cout << "Key Transpose Base: " << transposeBaseKey << "\n";
-
-                         // playing notes until no key is pressed
-                         int playMode = (machineState==play || machineState==recRequest || (machineState==initRequest && (lastMachineState==play || lastMachineState==recRequest))) && (noteOnQueueVector.size() > 0);
-                         if (playMode)
-                         {
-                             // rewrite note on event with value of 0x00 to a note off event
-                             if (((midiEvent.data[0] & 0xF0) == 0x90) && midiEvent.data[2] == 0) midiEvent.data[0] = (midiEvent.data[0] & 0x0F) + 0x80;
-
-                             switch (midiEvent.data[0] & 0xF0)
-                             {
-                                 case 0x80:
-                                 {
-                                     if ((noteOnQueueVector.size()>0) &&(activeNoteOnCount == 0))
-                                     {
-                                         for (int i=0;i<noteOnQueueVector.at(getSequencerIndex()).size();i++)
-                                         {
-                                             MidiEvent me = noteOnQueueVector.at(getSequencerIndex()).front();
-                                             noteOnQueueVector.at(getSequencerIndex()).pop();
-                                             noteOnQueueVector.at(getSequencerIndex()).push(me);
-                                             me.data[0] = (me.data[0] & 0x0F) + 0x80;  // create a note off
-                                             me.data[1] = (me.data[1] + 0x100 + transposeNote) % 0x100;
-                                             me.frame = uint32_t(midiEvent.frame+i);
-                                             writeMidiEvent(me);
-                                         }
-                                         getNextSequencerIndex();
-                                     }
-                                     break;
-                                 }
-                                 case 0x90:
-                                 {
-                                     if (activeNoteOnCount == 1)
-                                     {
-                                         if (noteOnQueueVector.size()>0)
-                                         {
-                                             int sindex = getSequencerIndex();
-                                             for (int i=0;i<noteOnQueueVector.at(sindex).size();i++)
-                                             {
-                                                 MidiEvent me = noteOnQueueVector.at(sindex).front();
-                                                 noteOnQueueVector.at(sindex).pop();
-                                                 noteOnQueueVector.at(sindex).push(me);
-                                                 me.frame = uint32_t(midiEvent.frame+i);
-                                                 me.data[0] = (me.data[0] & 0x0F) + 0x90;  // create a note on
-                                                 me.data[1] = (me.data[1] + 0x100 + transposeNote) % 0x100;
-                                                 writeMidiEvent(me);
-                                             }
-                                         }
-                                     }
-                                     break;
-                                 }
-                                 default:
-                                     writeMidiEvent(midiEvent);
-                                     break;
-                             }
-
-                         }
-
-                         // through all midi events, when no notes are in the queue array.
-                         int throughMode = (machineState==play || machineState==recRequest || (machineState==initRequest && (lastMachineState==play || lastMachineState==recRequest))) && (noteOnQueueVector.size() == 0);
-                         if (throughMode)
-                         {
-                             writeMidiEvent(midiEvent);
-                         }
-
-                         // recording notes until state logic isn't satisfied
-                         int recMode = (machineState==rec || machineState==playRequest || (machineState==initRequest && (lastMachineState==rec || lastMachineState==playRequest)));
-                         if (recMode)
-                         {
-                             switch (midiEvent.data[0] & 0xF0)
-                             {
-                                 case 0x90:
-                                 {
-                                     if (activeNoteOnCount == 1  && noteOnQueueVector.size()<MAX_NOTE_ON_GROUPS) noteOnQueueVector.push_back(MidiQueue());
-                                     MidiEvent me = midiEvent;
-                                     me.frame = activeNoteOnCount;
-                                     noteOnQueueVector.back().push(me);
-
-                                     break;
-
-                                 }
-                             }
-                             writeMidiEvent(midiEvent);
-
-                         }
-                     }
+                     if (lanes[i].activeNoteOnCount == 0) switchToSelectedSlot(lanes[i]);
+                     updateMachineState(lanes[i]);
                  }
-                 // state machine logic
-                 int oldMachineState = machineState;
-                 switch (machineState)
+                 prepareClock();
+                 // the event loop of the keypress action, again when a learned controller changes it
+                 for (uint32_t i=0; i<midiEventCount;)
                  {
-                     case init:
-                     {
-                         if (noteOnQueueVector.size()) noteOnQueueVector.clear();
-                         if (noteOnQueueVector.size()==0) machineState = play;
-                         break;
-                     }
-                     case play:
-                     {
-                         if (b_record == 1) machineState = recRequest;
-                         if (b_reset == 1) machineState = initRequest;
-                         break;
-                     }
-                     case recRequest:
-                     {
-                         if (activeNoteOnCount==0) machineState = rec;
-                         if (b_record == 0) machineState = play;
-                         if (b_reset == 1) machineState = initRequest;
-                         break;
-                     }
-                     case rec:
-                     {
-                         if (b_record == 0) machineState = playRequest;
-                         if (b_reset == 1) machineState = initRequest;
-                         break;
-                     }
-                     case playRequest:
-                     {
-                         if (b_record == 1) machineState = rec;
-                         if (activeNoteOnCount==0) machineState = play;
-                         if (b_reset == 1) machineState = initRequest;
-                         break;
-                     }
-                     case initRequest:
-                     {
-                         if ((b_reset == 0) & (activeNoteOnCount==0))
-                         {
-                             //b_record = 0;
-                             machineState = init;
-                         }
-                         break;
-                     }
+                     const int action = transposeOnKeys >= 0 && transposeOnKeys <= 2 ? transposeOnKeys : 0;
+                     i = (this->*kEventLoops[action])(midiEvents, midiEventCount, i);
                  }
-                 if (machineState != oldMachineState) lastMachineState=oldMachineState;
-
+                 advanceClock(frames);
+                 droppedEventCount += uint32_t(output.flush(frames, [this](const MidiEvent& event) { return writeMidiEvent(event); }));
+                 passedFrame = 0;
+                 blockStartTime += frames;
+                 // the outputs show the lane which got the last key, the state keeps the first lane
+                 const SequencerLane& shownLane(lanes[displayLane]);
+                 publishedGroupNumber.store(shownLane.pattern->size(), std::memory_order_relaxed);
+                 publishedActualGroup.store(shownLane.sequencerIndex+1, std::memory_order_relaxed);
+                 publishedPlayingSlot.store(lanes[0].playingSlot, std::memory_order_relaxed);
+                 publishedSelectedSlot.store(lanes[0].selectedSlot, std::memory_order_relaxed);
+                 publishedStepIndex.store(lanes[0].sequencerIndex, std::memory_order_relaxed);
+                 publishedDroppedEvents.store(droppedEventCount, std::memory_order_relaxed);
+#if defined(MIDIPERFOSEQ_BLOCK_STATS) || defined(MIDIPERFOSEQ_TRACE)
+                 const uint64_t blockNs = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - blockStart).count());
+#endif
+#ifdef MIDIPERFOSEQ_BLOCK_STATS
+                 blockStats[sequencerStyle >= 0 && sequencerStyle < styleCount ? sequencerStyle : 0].add(blockNs, midiEventCount, frames);
+#endif
+#ifdef MIDIPERFOSEQ_SELF_CHECK
+                 checkInvariants();
+#endif
+#ifdef MIDIPERFOSEQ_TRACE
+                 traceRecord(traceBlock, blockStartTime - frames, lanes[0], int32_t(frames), int32_t(midiEventCount), uint32_t(blockNs));
+#endif
              }
 
              // ------------------------------------------------------------------------------------------------------
 
 private:
-    // turing machine state
-    int machineState = init;
-    int lastMachineState = init;
-    // midi event queue vector
-    typedef std::queue<MidiEvent> MidiQueue;
-    typedef std::vector<MidiQueue> MidiQueueVector;
-    MidiQueueVector noteOnQueueVector;
-    // Actual index in noteOnQueueVector
-    int noteOnQueueVectorIndex = 0;  // initial value
+    // parameter values from the host, the values run() works with, and values reported back
+    ParameterExchange parameters;
+    float appliedParameters[parameterCount];
+    bool parameterApplied[parameterCount];
+    std::atomic<int> publishedGroupNumber{0};
+    std::atomic<int> publishedActualGroup{1};
+    std::atomic<uint32_t> publishedDroppedEvents{0};
+    static const int RESTORE_BANK_COUNT = 3;
+    static const uint32_t RESTORE_PENDING = 4;
+    // pattern slots of recorded note on groups, preallocated: the stores in use and the restore banks
+    PatternStore patternStores[(1+RESTORE_BANK_COUNT)*MAX_PATTERN_SLOTS];
+    PatternStore* slots[MAX_PATTERN_SLOTS];
+    // the sequencer lanes, the lane of every channel and key, and the lane each sounding key went to
+    SequencerLane lanes[MAX_SEQUENCER_LANES];
+    uint8_t laneOfKey[16][128];
+    uint8_t keyLane[16][128];
+    bool laneInUse[MAX_SEQUENCER_LANES];
+    int laneDispatchMode = laneSingle;
+    int laneSplitKeys[MAX_SEQUENCER_LANES-1] = { 48, 60, 72 };
+    bool laneMapDirty = false;
+    int displayLane = 0;  // the lane shown by the output parameters
+    // the slots in use and their change count (odd while run() modifies them) for getState(),
+    // with the slots and the step index of the first lane
+    std::atomic<PatternStore*> publishedSlots[MAX_PATTERN_SLOTS];
+    std::atomic<int> publishedSelectedSlot{0};
+    std::atomic<int> publishedPlayingSlot{0};
+    std::atomic<int> publishedStepIndex{0};
+    std::atomic<uint32_t> patternRevision{0};
+    // decoded slots for run() to swap in: setState fills one bank, one is handed over
+    // (RESTORE_PENDING until run() takes it) and one is the last run() took, none waits for another
+    RestoredBank restoreBanks[RESTORE_BANK_COUNT];
+    int restoreFillBank = 0;  // setState side
+    int restoreTakenBank = 1;  // run() side
+    std::atomic<uint32_t> restoreHandoverBank{2};
+    std::atomic<bool> audioActive{false};
+#ifdef MIDIPERFOSEQ_BLOCK_STATS
+    // run() timing per sequencer style, reported on deactivation
+    BlockStats blockStats[styleCount];
+#endif
+#ifdef MIDIPERFOSEQ_TRACE
+    // records of run() and the thread printing them
+    TraceRing trace;
+    std::atomic<bool> traceRunning{false};
+    std::thread traceThread;
+#endif
     // Sequencer Style
     int sequencerStyle = 0;
-    // sequencer step
-    int sequencerStep = 1;
-    // sequencer substep counter and step size
-    int sequencerSubStep = 0;
+    // random styles
+    int randomSeed = 0;
+    // sequencer substep size
     int sequencerSubStepsUp = 2;
     int sequencerSubStepsDown = 1;
+    // step clock
+    int stepClockMode = clockKeys;
+    int stepClockRate = rateSixteenth;
+    int stepGateLength = 50;
+    int64_t clockTick = 0;         // step count of the next clocked step
+    bool clockTickValid = false;
+    bool hostTransportPlaying = false;  // at the last block, a stop ends the clocked lanes
+    double clockNextFrame = -1.0;  // frame of the next clocked step in this block, <0 for none
+    double clockFramesPerStep = 0.0;
+    // midi clock input
+    MidiClockTracker midiClockTracker;
+    bool midiClockRunning = false;
+    int64_t midiClockCount = 0;    // clocks since the last start
+    double midiStepTime = -1.0;    // time of the pending clocked step, <0 for none
+    uint64_t lastScheduledTime = 0;  // time of the last scheduled event sent
+    double framesPerQuarter = 22050.0;  // host tempo, read with every block
+    // note repeats
+    int ratchetHits = 1;
+    int ratchetRateIndex = rateThirtySecond;
+    int ratchetDecayPercent = 15;
+    // scaling of the recorded onsets within a step
+    int strumPercent = 100;
+    // pending events and frames since activation at the start of the current block
+    EventScheduler scheduler;
+    uint64_t blockStartTime = 0;
+    uint32_t currentFrame = 0;  // frame of the event in process
+    // output events of the block in frame order, and events the buffer or the host couldn't take
+    OutputBuffer output;
+    uint32_t droppedEventCount = 0;
+    uint32_t passedFrame = 0;  // frame of the last input event passed on in this block
+    // generated notes which are sounding, and input notes passed through
+    ActiveNoteTable activeNotes;
+    ActiveNoteTable thruNotes;
     // transposing
-    MidiEvent lastNoteOnEvent;
     int transposeSemiNotes = 0;
     int transposeOnKeys = 0;
     int transposeBaseKey = 36;
+    int transposeScale = scaleChromatic;
+    int transposeScaleRoot = 0;
+    PitchTable pitchTable;  // output pitch of every transposed note in the scale
+    // controllers bound to parameters, and the parameter ranges they are scaled to
+    MidiLearnMap learnMap;
+    ParameterRanges controlRanges[parameterCount];
+    uint32_t controlHints[parameterCount];
+    int learnTargetValue = learnOff;
+    bool learnFilterOn = false;
+    // recording into a copy of the slot while it keeps playing, one copy per lane
+    bool overdubOn = false;
+    bool replaceStepsOn = false;  // a chord of a take replaces the step at the cursor instead of being appended
+    PatternStore overdubStores[MAX_SEQUENCER_LANES];
 
-    // midi note ON poly counter
-    int activeNoteOnCount = 0;
     // recording switch
     int b_record = 0;
     // trigger
@@ -5,6 +5,8 @@
 
 const int MAX_NOTE_ON_GROUPS = 128;
 const int MAX_SEQUENCER_STEPS_SIZE = 16;
+const int MAX_NOTES_PER_STEP = 16;
+const int MAX_PATTERN_SLOTS = 8;
 
 struct midiQueueEvent {
     int group;
@@ -23,16 +25,102 @@ enum Parameters {
     transposeKeyBase,
     groupNumber,
     actualGroup,
+    seqSeed,
+    clockMode,
+    clockRate,
+    gateLength,
+    patternSlot,
+    laneMode,
+    laneSplit1,
+    laneSplit2,
+    laneSplit3,
+    droppedEvents,
+    ratchetCount,
+    ratchetRate,
+    ratchetDecay,
+    strumScale,
+    scaleType,
+    scaleRoot,
+    learnTarget,
+    learnFilter,
+    overdub,
+    replaceSteps,
     parameterCount
 };
 
+enum States {
+    sPattern,
+    sImportMidiFile,
+    sExportMidiFile,
+    sMidiLearn,
+    statesCount
+};
+
 enum PortGroups {
     gRecord,
     gSequencer,
     gTranspose,
+    gClock,
+    gLanes,
+    gRatchet,
+    gMidiLearn,
     portGroupsCount
 };
 
+enum SequencerStyle {
+    styleForward,
+    styleBackward,
+    stylePingPong,
+    styleSpiral,
+    styleStepUpDown,
+    styleRandom,
+    styleRandomNoRepeat,
+    styleRandomWeighted,
+    styleCount
+};
+
+enum ClockMode {
+    clockKeys,      // a step per key release
+    clockHost,      // a step per host transport tick while keys are held
+    clockMidi,      // a step per tick of the midi clock input while keys are held
+    clockPads,      // every key from the transpose base key on plays its own step while held
+    clockModeCount
+};
+
+enum ClockRate {
+    rateQuarter,
+    rateEighth,
+    rateSixteenth,
+    rateThirtySecond,
+    rateQuarterTriplet,
+    rateEighthTriplet,
+    rateSixteenthTriplet,
+    rateThirtySecondTriplet,
+    clockRateCount
+};
+
+enum ScaleType {
+    scaleChromatic,
+    scaleMajor,
+    scaleMinor,
+    scaleDorian,
+    scalePhrygian,
+    scaleLydian,
+    scaleMixolydian,
+    scaleLocrian,
+    scaleHarmonicMinor,
+    scaleMajorPentatonic,
+    scaleMinorPentatonic,
+    scaleTypeCount
+};
+
+enum LaneMode {
+    laneSingle,     // every event drives the first lane
+    laneByChannel,  // midi channel 1-4 drive lane 1-4, higher channels wrap around
+    laneByKeyZone,  // the split keys divide the keyboard into one zone per lane
+    laneModeCount
+};
+
 enum MachineState {
     init,
     play,
@@ -0,0 +1,108 @@
+#ifndef MIDI_PERFOSEQ_OUTPUT_BUFFER_INCLUDED
+#define MIDI_PERFOSEQ_OUTPUT_BUFFER_INCLUDED
+
+#include "DistrhoPlugin.hpp"
+#include <cstdint>
+
+const int MAX_OUTPUT_EVENTS = 1024;
+
+/*
+ * The generated output events of a block, kept in frame order. Events are inserted from
+ * the back, so the usual nearly ordered stream costs O(1) per event and events of the same
+ * frame keep the order they were produced in.
+ * The events due before an input event are written ahead of it during the block,
+ * events beyond the end of a block stay in the buffer for the next one.
+ */
+class OutputBuffer
+{
+public:
+    OutputBuffer() : first(0), count(0) {}
+
+    void clear() { first = count = 0; }
+
+    // drops the events still to be written but the note offs, which move to the start of the next block
+    void keepNoteOffs()
+    {
+        int kept = 0;
+        for (int i=first;i<count;i++)
+        {
+            if ((events[i].data[0] & 0xF0) != 0x80) continue;
+            events[kept] = events[i];
+            events[kept].frame = 0;
+            kept += 1;
+        }
+        first = 0;
+        count = kept;
+    }
+
+    bool empty() const { return first == count; }
+
+    // false when the buffer is full
+    bool add(const MidiEvent& event)
+    {
+        if (count >= MAX_OUTPUT_EVENTS && first > 0) compact(0);
+        if (count >= MAX_OUTPUT_EVENTS) return false;
+        int i = count;
+        while (i > first && events[i-1].frame > event.frame)
+        {
+            events[i] = events[i-1];
+            i -= 1;
+        }
+        events[i] = event;
+        count += 1;
+        return true;
+    }
+
+    /*
+     * Hands the events up to and including the given frame to write(event) in frame order,
+     * an event written next at that frame follows them. Returns how many events write() refused.
+     */
+    template <class Writer>
+    int writeUntil(uint32_t frame, Writer write)
+    {
+        int refused = 0;
+        while (first < count && events[first].frame <= frame)
+        {
+            if (! write(events[first])) refused += 1;
+            first += 1;
+        }
+        return refused;
+    }
+
+    /*
+     * Hands the remaining events of a block of the given length to write(event) in frame order
+     * and moves the later ones to the start of the next block. Returns how many events
+     * write() refused.
+     */
+    template <class Writer>
+    int flush(uint32_t frames, Writer write)
+    {
+        int refused = 0;
+        while (first < count && events[first].frame < frames)
+        {
+            if (! write(events[first])) refused += 1;
+            first += 1;
+        }
+        compact(frames);
+        return refused;
+    }
+
+private:
+    // drops the written events, the others move to the front, earlier by the given frames
+    void compact(uint32_t frames)
+    {
+        for (int i=first;i<count;i++)
+        {
+            events[i-first] = events[i];
+            events[i-first].frame -= frames;
+        }
+        count -= first;
+        first = 0;
+    }
+
+    MidiEvent events[MAX_OUTPUT_EVENTS];
+    int first;  // events before it are written
+    int count;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef MIDI_PERFOSEQ_PARAMETER_EXCHANGE_INCLUDED
+#define MIDI_PERFOSEQ_PARAMETER_EXCHANGE_INCLUDED
+
+#include "MidiPerfoSeq.h"
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Lock free handoff of the parameter values from the control thread to the audio thread.
+ * The writer (setParameterValue) stores the value and then bumps the change count of
+ * that parameter, the audio thread takes only the parameters whose count moved since
+ * its last look, so a parameter the host didn't touch keeps whatever run() set it to.
+ * Values run() sets itself (midi learn) are reported back and read by the host until
+ * it writes that parameter again. Neither side ever blocks.
+ * There is one writer thread at a time, as with the plugin hosts.
+ */
+class ParameterExchange
+{
+public:
+    ParameterExchange()
+    {
+        for (int i=0;i<parameterCount;i++)
+        {
+            values[i].store(0.0f, std::memory_order_relaxed);
+            changes[i].store(0, std::memory_order_relaxed);
+            reportedValues[i].store(0.0f, std::memory_order_relaxed);
+            reportedChange[i].store(NOT_REPORTED, std::memory_order_relaxed);
+            accepted[i] = 0;
+        }
+    }
+
+    // control side
+    void set(uint32_t index, float value)
+    {
+        if (index >= uint32_t(parameterCount)) return;
+        values[index].store(value, std::memory_order_relaxed);
+        changes[index].fetch_add(1, std::memory_order_release);
+    }
+
+    // the value reported by run() when the host hasn't written the parameter since, else the host's one
+    float get(uint32_t index) const
+    {
+        if (index >= uint32_t(parameterCount)) return 0.0f;
+        if (reportedChange[index].load(std::memory_order_acquire) == changes[index].load(std::memory_order_acquire))
+            return reportedValues[index].load(std::memory_order_relaxed);
+        return values[index].load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Audio side: copies the values the host wrote since the last fetch into snapshot
+     * and flags them in changed. Returns false when there is none.
+     */
+    bool fetch(float* snapshot, bool* changed)
+    {
+        bool any = false;
+        for (int i=0;i<parameterCount;i++)
+        {
+            const uint32_t count = changes[i].load(std::memory_order_acquire);
+            changed[i] = count != accepted[i];
+            if (! changed[i]) continue;
+            snapshot[i] = values[i].load(std::memory_order_relaxed);
+            accepted[i] = count;
+            any = true;
+        }
+        return any;
+    }
+
+    // audio side: a value run() set by itself, superseded by the next write of the host
+    void report(uint32_t index, float value)
+    {
+        if (index >= uint32_t(parameterCount)) return;
+        reportedValues[index].store(value, std::memory_order_relaxed);
+        reportedChange[index].store(accepted[index], std::memory_order_release);
+    }
+
+private:
+    static const uint32_t NOT_REPORTED = ~0u;
+
+    std::atomic<float> values[parameterCount];
+    std::atomic<uint32_t> changes[parameterCount];
+    std::atomic<float> reportedValues[parameterCount];
+    std::atomic<uint32_t> reportedChange[parameterCount];  // change count the report belongs to
+    uint32_t accepted[parameterCount];  // audio side only
+};
+
+#endif
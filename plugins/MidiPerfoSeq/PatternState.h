@@ -0,0 +1,160 @@
+#ifndef MIDI_PERFOSEQ_PATTERN_STATE_INCLUDED
+#define MIDI_PERFOSEQ_PATTERN_STATE_INCLUDED
+
+#include "MidiPerfoSeq.h"
+#include "PatternStore.h"
+#include <cstdint>
+
+/*
+ * Compact binary encoding of the pattern slots and the sequencer settings.
+ *
+ *   "MPS" version                        4 bytes
+ *   settings count, (index, int32)*      1 + 5 per setting  (version 4, before: int16, 3 per setting)
+ *   playing slot, step index             2        (version 2, version 1 has the step index only)
+ *   slot count                           1        (version 2, version 1 holds one pattern)
+ *   per slot: step count, (note count, notes)*   1 + per step 1 + 5 per note (status, note, velocity, offset)
+ *
+ * Settings are stored as parameter index/value pairs, so parameters added later
+ * don't change the layout. Multi byte values are little endian.
+ * Versions before 3 have no note offsets (3 bytes per note), their chords start at once.
+ * Versions before 4 kept the settings in 16 bits, which wrapped seeds above 32767.
+ */
+const uint8_t PATTERN_STATE_VERSION = 4;
+const int MAX_PATTERN_SLOT_STATE_SIZE = 1 + MAX_NOTE_ON_GROUPS + 5 * MAX_NOTE_ON_GROUPS * MAX_NOTES_PER_STEP;
+const int MAX_PATTERN_STATE_SIZE = 4 + 1 + 5 * parameterCount + 3
+                                 + MAX_PATTERN_SLOTS * MAX_PATTERN_SLOT_STATE_SIZE;
+
+struct PatternSetting {
+    uint8_t index;
+    int32_t value;
+};
+
+/*
+ * Writes the encoding into out (at least MAX_PATTERN_STATE_SIZE bytes), returns its length.
+ */
+inline int encodePatternState(const PatternStore* const* slots, int slotCount, int playingSlot, int stepIndex,
+                              const PatternSetting* settings, int settingCount, uint8_t* out)
+{
+    int pos = 0;
+    out[pos++] = 'M';
+    out[pos++] = 'P';
+    out[pos++] = 'S';
+    out[pos++] = PATTERN_STATE_VERSION;
+    out[pos++] = uint8_t(settingCount);
+    for (int i=0;i<settingCount;i++)
+    {
+        out[pos++] = settings[i].index;
+        const uint32_t value = uint32_t(settings[i].value);
+        for (int shift=0;shift<32;shift+=8) out[pos++] = uint8_t(value >> shift);
+    }
+    out[pos++] = uint8_t(playingSlot);
+    out[pos++] = uint8_t(stepIndex);
+    out[pos++] = uint8_t(slotCount);
+    for (int slot=0;slot<slotCount;slot++)
+    {
+        const PatternStore& pattern(*slots[slot]);
+        out[pos++] = uint8_t(pattern.size());
+        for (int s=0;s<pattern.size();s++)
+        {
+            const PatternNote* notes = pattern.stepNotes(s);
+            const int count = pattern.stepLength(s);
+            out[pos++] = uint8_t(count);
+            for (int i=0;i<count;i++)
+            {
+                out[pos++] = notes[i].status;
+                out[pos++] = notes[i].note;
+                out[pos++] = notes[i].velocity;
+                out[pos++] = uint8_t(notes[i].offset & 0xFF);
+                out[pos++] = uint8_t(notes[i].offset >> 8);
+            }
+        }
+    }
+    return pos;
+}
+
+/*
+ * Reads the steps of one pattern, returns the position behind it or -1 for truncated data.
+ */
+inline int decodePatternSlot(const uint8_t* data, int size, int pos, uint8_t version, PatternStore& pattern)
+{
+    const int noteSize = version >= 3 ? 5 : 3;
+    pattern.clear();
+    if (pos >= size) return -1;
+    const int steps = data[pos++];
+    for (int s=0;s<steps;s++)
+    {
+        if (pos >= size) return -1;
+        const int count = data[pos++];
+        if (pos + noteSize * count > size) return -1;
+        pattern.appendStep();
+        for (int i=0;i<count;i++)
+        {
+            const uint16_t offset = noteSize == 5 ? uint16_t(data[pos+3] | (data[pos+4] << 8)) : 0;
+            const PatternNote note = { data[pos], data[pos+1], data[pos+2], offset };
+            pattern.appendNote(note);
+            pos += noteSize;
+        }
+    }
+    return pos;
+}
+
+/*
+ * Reads an encoding into slots (slotCapacity stores, each cleared when it is contained),
+ * settings (room for parameterCount entries), playingSlot and stepIndex.
+ * slotCount tells how many slots were read. Returns false for data which isn't
+ * a valid encoding of a known version.
+ */
+inline bool decodePatternState(const uint8_t* data, int size, PatternStore* const* slots, int slotCapacity,
+                               int& slotCount, int& playingSlot, int& stepIndex,
+                               PatternSetting* settings, int& settingCount)
+{
+    slotCount = 0;
+    settingCount = 0;
+    playingSlot = 0;
+    stepIndex = 0;
+    if (size < 7 || data[0] != 'M' || data[1] != 'P' || data[2] != 'S') return false;
+    const uint8_t version = data[3];
+    if (version == 0 || version > PATTERN_STATE_VERSION) return false;
+    int pos = 4;
+    const int settingSize = version >= 4 ? 5 : 3;
+    const int storedSettings = data[pos++];
+    if (pos + settingSize * storedSettings + 2 > size) return false;
+    for (int i=0;i<storedSettings;i++)
+    {
+        PatternSetting setting;
+        setting.index = data[pos];
+        if (settingSize == 5)
+            setting.value = int32_t(uint32_t(data[pos+1]) | uint32_t(data[pos+2]) << 8
+                                    | uint32_t(data[pos+3]) << 16 | uint32_t(data[pos+4]) << 24);
+        else if (setting.index == seqSeed)  // the only setting above 32767, it was stored wrapped
+            setting.value = uint16_t(data[pos+1] | (data[pos+2] << 8));
+        else
+            setting.value = int16_t(uint16_t(data[pos+1] | (data[pos+2] << 8)));
+        pos += settingSize;
+        if (setting.index < parameterCount && settingCount < parameterCount) settings[settingCount++] = setting;
+    }
+    int storedSlots = 1;
+    if (version >= 2)
+    {
+        if (pos + 3 > size) return false;
+        playingSlot = data[pos++];
+        stepIndex = data[pos++];
+        storedSlots = data[pos++];
+    }
+    else
+    {
+        stepIndex = data[pos++];
+    }
+    for (int slot=0;slot<storedSlots && slot<slotCapacity;slot++)
+    {
+        pos = decodePatternSlot(data, size, pos, version, *slots[slot]);
+        if (pos < 0) return false;
+        slotCount += 1;
+    }
+    if (slotCount == 0) return false;
+    if (playingSlot >= slotCount) playingSlot = 0;
+    if (stepIndex >= slots[playingSlot]->size()) stepIndex = 0;
+    return true;
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef MIDI_PERFOSEQ_PATTERN_STORE_INCLUDED
+#define MIDI_PERFOSEQ_PATTERN_STORE_INCLUDED
+
+#include "MidiPerfoSeq.h"
+#include <cstdint>
+#include <cstring>
+
+// resolution of the note onsets within a step
+const int PATTERN_TICKS_PER_QUARTER = 960;
+
+/*
+ * A recorded note, reduced to what playback needs.
+ */
+struct PatternNote {
+    uint8_t status;    // note on status byte incl. channel
+    uint8_t note;
+    uint8_t velocity;
+    uint16_t offset;   // onset after the first note of the step, in ticks
+};
+
+/*
+ * Span of one step (note on group) inside the packed note array.
+ */
+struct StepSpan {
+    uint16_t offset;
+    uint16_t length;
+};
+
+/*
+ * Fixed capacity storage of the recorded note on groups (steps).
+ * All notes are packed back to back in one array, every step only keeps
+ * its offset and length, so a chord is a contiguous read.
+ * All memory is part of the object, so after construction neither recording
+ * nor clearing touches the heap and every operation runs in bounded time.
+ */
+class PatternStore
+{
+public:
+    PatternStore() : stepCount(0), noteCount(0) {}
+
+    int size() const { return stepCount; }
+    bool empty() const { return stepCount == 0; }
+    bool full() const { return stepCount >= MAX_NOTE_ON_GROUPS; }
+
+    // forget all steps, the note data is simply overwritten by the next recording
+    void clear()
+    {
+        stepCount = 0;
+        noteCount = 0;
+    }
+
+    // take over the steps of another store, only the part in use is copied
+    void copyFrom(const PatternStore& other)
+    {
+        stepCount = other.stepCount;
+        noteCount = other.noteCount;
+        std::memcpy(steps, other.steps, sizeof(StepSpan) * stepCount);
+        std::memcpy(notes, other.notes, sizeof(PatternNote) * noteCount);
+    }
+
+    // open a new (empty) step behind the last one, returns false when all groups are in use
+    bool appendStep()
+    {
+        if (full()) return false;
+        steps[stepCount].offset = uint16_t(noteCount);
+        steps[stepCount].length = 0;
+        stepCount += 1;
+        return true;
+    }
+
+    // add a note to the last step, returns false when there is no step or the step is full
+    bool appendNote(const PatternNote& note)
+    {
+        if (empty()) return false;
+        StepSpan& span = steps[stepCount-1];
+        if (span.length >= MAX_NOTES_PER_STEP) return false;
+        notes[noteCount] = note;
+        noteCount += 1;
+        span.length += 1;
+        return true;
+    }
+
+    // empty a step in its place for new notes, the notes of the steps behind it move up
+    void clearStep(int index)
+    {
+        StepSpan& span = steps[index];
+        const int end = span.offset + span.length;
+        std::memmove(notes + span.offset, notes + end, sizeof(PatternNote) * (noteCount - end));
+        noteCount -= span.length;
+        for (int i=index+1;i<stepCount;i++) steps[i].offset -= span.length;
+        span.length = 0;
+    }
+
+    // add a note to any step, the notes of the steps behind it move down,
+    // returns false when there is no such step or the step is full
+    bool insertNote(int index, const PatternNote& note)
+    {
+        if (index < 0 || index >= stepCount) return false;
+        StepSpan& span = steps[index];
+        if (span.length >= MAX_NOTES_PER_STEP) return false;
+        const int end = span.offset + span.length;
+        std::memmove(notes + end + 1, notes + end, sizeof(PatternNote) * (noteCount - end));
+        notes[end] = note;
+        noteCount += 1;
+        span.length += 1;
+        for (int i=index+1;i<stepCount;i++) steps[i].offset += 1;
+        return true;
+    }
+
+    // number of notes in all steps
+    int totalNotes() const { return noteCount; }
+
+    // step holding the note with the given position in the packed array
+    int stepOfNote(int noteIndex) const
+    {
+        int lo = 0;
+        int hi = stepCount - 1;
+        while (lo < hi)
+        {
+            const int mid = (lo + hi + 1) / 2;
+            if (steps[mid].offset <= noteIndex)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        return lo;
+    }
+
+    // first note and note count of a step
+    const PatternNote* stepNotes(int index) const { return notes + steps[index].offset; }
+    int stepLength(int index) const { return steps[index].length; }
+
+private:
+    PatternNote notes[MAX_NOTE_ON_GROUPS * MAX_NOTES_PER_STEP];
+    StepSpan steps[MAX_NOTE_ON_GROUPS];
+    int stepCount;
+    int noteCount;
+};
+
+/*
+ * Decoded slots waiting for the audio thread: the stores of the slots in slotMask
+ * replace the ones in use, the replaced stores stay with the bank.
+ */
+struct RestoredBank
+{
+    PatternStore* stores[MAX_PATTERN_SLOTS];
+    uint32_t slotMask = 0;
+    int playingSlot = -1;  // <0: keep playing the same slot
+    int stepIndex = 0;
+};
+
+#endif
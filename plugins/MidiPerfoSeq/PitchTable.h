@@ -0,0 +1,82 @@
+#ifndef MIDI_PERFOSEQ_PITCH_TABLE_INCLUDED
+#define MIDI_PERFOSEQ_PITCH_TABLE_INCLUDED
+
+#include "MidiPerfoSeq.h"
+#include <cstdint>
+
+// pitch classes of each scale as a bit mask, bit 0 is the root, indexed by ScaleType
+static const uint16_t kScaleMasks[scaleTypeCount] = {
+    0xFFF,  // chromatic
+    0xAB5,  // major (ionian)     C D E F G A B
+    0x5AD,  // natural minor      C D Eb F G Ab Bb
+    0x6AD,  // dorian             C D Eb F G A Bb
+    0x5AB,  // phrygian           C Db Eb F G Ab Bb
+    0xAD5,  // lydian             C D E F# G A B
+    0x6B5,  // mixolydian         C D E F G A Bb
+    0x56B,  // locrian            C Db Eb F Gb Ab Bb
+    0x9AD,  // harmonic minor     C D Eb F G Ab B
+    0x295,  // major pentatonic   C D E G A
+    0x4A9   // minor pentatonic   C Eb F G Bb
+};
+
+// transpositions the table covers directly, further ones are reduced by octaves
+const int PITCH_TABLE_TRANSPOSE_RANGE = 160;
+
+/*
+ * Output pitch of every transposed note for one scale: the pitch is moved to the
+ * nearest pitch of the scale (the lower one on a tie) and folded by octaves into 0..127,
+ * so it always is a valid midi note.
+ * The table is indexed by note + transposition, so changing the transposition,
+ * as the keys do when the pattern follows them, costs nothing. It is only rebuilt
+ * when the scale or its root change, a lookup is a single load.
+ */
+class PitchTable
+{
+public:
+    PitchTable() : scale(-1), root(0) { update(scaleChromatic, 0); }
+
+    uint8_t at(uint8_t note, int transpose) const
+    {
+        // beyond the range every note lands above 127 or below 0, where an octave doesn't change the folded pitch
+        while (transpose > PITCH_TABLE_TRANSPOSE_RANGE) transpose -= 12;
+        while (transpose < -PITCH_TABLE_TRANSPOSE_RANGE) transpose += 12;
+        return pitches[(note & 0x7F) + transpose + PITCH_TABLE_TRANSPOSE_RANGE];
+    }
+
+    // rebuild when the scale changed
+    void update(int newScale, int newRoot)
+    {
+        if (newScale < 0 || newScale >= scaleTypeCount) newScale = scaleChromatic;
+        newRoot = ((newRoot % 12) + 12) % 12;
+        if (newScale == scale && newRoot == root) return;
+        scale = newScale;
+        root = newRoot;
+        const uint16_t mask = kScaleMasks[scale];
+        for (int index=0;index<PITCH_TABLE_SIZE;index++)
+        {
+            int pitch = index - PITCH_TABLE_TRANSPOSE_RANGE;
+            for (int distance=0;distance<=6;distance++)
+            {
+                if (inScale(mask, pitch - distance)) { pitch -= distance; break; }
+                if (inScale(mask, pitch + distance)) { pitch += distance; break; }
+            }
+            while (pitch > 127) pitch -= 12;
+            while (pitch < 0) pitch += 12;
+            pitches[index] = uint8_t(pitch);
+        }
+    }
+
+private:
+    bool inScale(uint16_t mask, int pitch) const
+    {
+        return (mask >> ((((pitch - root) % 12) + 12) % 12)) & 1;
+    }
+
+    static const int PITCH_TABLE_SIZE = 128 + 2 * PITCH_TABLE_TRANSPOSE_RANGE;
+
+    uint8_t pitches[PITCH_TABLE_SIZE];
+    int scale;
+    int root;
+};
+
+#endif
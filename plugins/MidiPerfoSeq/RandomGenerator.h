@@ -0,0 +1,44 @@
+#ifndef MIDI_PERFOSEQ_RANDOM_GENERATOR_INCLUDED
+#define MIDI_PERFOSEQ_RANDOM_GENERATOR_INCLUDED
+
+#include <cstdint>
+
+/*
+ * Small PCG32 generator (O'Neill, pcg-random.org).
+ * Every plugin instance owns one, so there is no hidden global state,
+ * no locking and a given seed always yields the same sequence.
+ */
+class RandomGenerator
+{
+public:
+    explicit RandomGenerator(uint32_t seedValue = 0) { seed(seedValue); }
+
+    void seed(uint32_t seedValue)
+    {
+        state = 0;
+        next();
+        state += 0x853c49e6748fea9bULL + seedValue;
+        next();
+    }
+
+    uint32_t next()
+    {
+        const uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        const uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        const uint32_t rot = uint32_t(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+    }
+
+    // value in 0..range-1, multiply and shift instead of the biased and slower modulo
+    uint32_t below(uint32_t range)
+    {
+        return uint32_t((uint64_t(next()) * range) >> 32);
+    }
+
+private:
+    static const uint64_t increment = 0xda3e39cb94b95bdbULL;
+    uint64_t state;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef MIDI_PERFOSEQ_SEQUENCER_LANE_INCLUDED
+#define MIDI_PERFOSEQ_SEQUENCER_LANE_INCLUDED
+
+#include "MidiPerfoSeq.h"
+#include "PatternStore.h"
+#include "StepOrderTable.h"
+#include "RandomGenerator.h"
+#include "ActiveNoteTable.h"
+#include <cstdint>
+
+const int MAX_SEQUENCER_LANES = 4;
+const int MAX_RATCHET_HITS = 16;
+const int MAX_PAD_VOICES = 16;
+const uint8_t KEY_STEP_NONE = 0xFF;
+
+// a generated note of the chord started by the keys
+struct HeldNote {
+    uint8_t channel;
+    uint8_t note;
+    uint8_t velocity;
+};
+
+/*
+ * Note repeats of the step a lane plays. Only the next hit is kept,
+ * the hits are generated while time passes.
+ */
+struct Ratchet {
+    int remaining = 0;          // hits still to come, 0 when idle
+    double nextTime = 0.0;      // frames since activation
+    double interval = 0.0;      // frames between hits
+    uint64_t endTime = 0;       // no hits from here on (end of a clocked gate)
+    float velocityScale = 1.0f;
+    HeldNote notes[MAX_NOTES_PER_STEP];
+    int noteCount = 0;
+
+    uint64_t hitTime() const { return uint64_t(nextTime + 1e-6); }
+};
+
+// what a lane does with its events
+enum LaneEventMode {
+    eventsIdle,
+    eventsPlay,    // plays the pattern, or passes the events through while it is empty
+    eventsRecord,
+    laneEventModeCount
+};
+
+/*
+ * The event mode of every machine state, indexed by the state and the one before it:
+ * an initRequest keeps doing what the state before it did until the lane is cleared.
+ */
+static const uint8_t kLaneEventModes[stateCount][stateCount] = {
+    // last state: init, play, recRequest, rec, playRequest, initRequest
+    { eventsIdle, eventsIdle, eventsIdle, eventsIdle, eventsIdle, eventsIdle },                    // init
+    { eventsPlay, eventsPlay, eventsPlay, eventsPlay, eventsPlay, eventsPlay },                    // play
+    { eventsPlay, eventsPlay, eventsPlay, eventsPlay, eventsPlay, eventsPlay },                    // recRequest
+    { eventsRecord, eventsRecord, eventsRecord, eventsRecord, eventsRecord, eventsRecord },        // rec
+    { eventsRecord, eventsRecord, eventsRecord, eventsRecord, eventsRecord, eventsRecord },        // playRequest
+    { eventsIdle, eventsPlay, eventsPlay, eventsRecord, eventsRecord, eventsIdle }                 // initRequest
+};
+
+/*
+ * Note ons of a strummed step which are still to come, in onset order.
+ */
+struct Strum {
+    HeldNote notes[MAX_NOTES_PER_STEP];
+    uint64_t times[MAX_NOTES_PER_STEP];  // frames since activation
+    uint64_t gate = 0;                   // note length, 0 for notes held until the key release
+    int next = 0;
+    int count = 0;
+
+    bool pending() const { return next < count; }
+    void cancel() { next = count = 0; }
+};
+
+// the notes a key started in key pad mode, until its release
+struct PadVoice {
+    uint8_t channel;  // of the key
+    uint8_t key;
+    HeldNote notes[MAX_NOTES_PER_STEP];
+    int noteCount;
+};
+
+/*
+ * One sequencer of the plugin instance: its state machine, the slot it plays,
+ * its step cursor and the keys which drive it.
+ * The lanes of an instance share the pattern slots, the settings and the midi output,
+ * incoming events are dispatched to a lane by channel or key zone.
+ */
+struct SequencerLane {
+    // turing machine state
+    int machineState = init;
+    int lastMachineState = init;
+    int eventMode = eventsIdle;  // kLaneEventModes of the two states, updated with every transition
+    // the playing slot, and the slot recorded into and played from the next step boundary on
+    PatternStore* pattern = nullptr;
+    int playingSlot = 0;
+    int selectedSlot = 0;
+    // actual step index in the pattern
+    int sequencerIndex = 0;
+    // precomputed step order of the style and its cursor
+    StepOrderTable stepOrder;
+    int stepOrderCursor = 0;
+    bool stepOrderDirty = true;
+    RandomGenerator random;
+    // input keys counted in activeNoteOnCount, and the chord they started
+    ActiveNoteTable heldKeys;
+    int activeNoteOnCount = 0;
+    HeldNote heldNotes[MAX_NOTES_PER_STEP];
+    int heldNoteCount = 0;
+    Ratchet ratchet;
+    Strum strum;
+    // key pad mode: the step of every key, and the sounding keys in the order they were pressed
+    uint8_t keySteps[128];
+    bool keyStepsDirty = true;
+    PadVoice padVoices[MAX_PAD_VOICES];
+    int padVoiceCount = 0;
+    // start of the step being recorded, frames since activation
+    uint64_t recordStepTime = 0;
+    // overdub: the copy of the selected slot recorded into while the slot keeps playing,
+    // swapped in at the end of the take. overdubSlot is -1 while no take is open
+    PatternStore* overdubStore = nullptr;
+    int overdubSlot = -1;
+    bool overdubReplace = false;  // a reset was deferred to the next take, which starts empty
+    int recordStep = -1;          // step of the take the chord goes into in place, -1: appended
+    // transposing
+    MidiEvent lastNoteOnEvent = {};
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef MIDI_PERFOSEQ_STEP_ORDER_TABLE_INCLUDED
+#define MIDI_PERFOSEQ_STEP_ORDER_TABLE_INCLUDED
+
+#include "MidiPerfoSeq.h"
+#include <cstdint>
+
+// longest cycle: step up/down style visits every (index, substep) pair once
+const int MAX_STEP_ORDER_SIZE = MAX_NOTE_ON_GROUPS * MAX_SEQUENCER_STEPS_SIZE;
+
+/*
+ * The cyclic order in which a sequencer style visits the steps of a pattern.
+ * Built whenever the pattern length or the style parameters change, the sequencer
+ * then only moves a cursor through the table.
+ * The storage is part of the object, building is bounded by MAX_STEP_ORDER_SIZE.
+ */
+class StepOrderTable
+{
+public:
+    StepOrderTable() : count(0), subSteps(1) {}
+
+    int length() const { return count; }
+    int at(int position) const { return order[position]; }
+
+    /*
+     * Fill the table for the given style and pattern length.
+     * The random style has no fixed order, it gets the forward order.
+     */
+    void build(int style, int steps, int stepsUp, int stepsDown)
+    {
+        count = 0;
+        subSteps = 1;
+        if (steps <= 0) return;
+        switch (style)
+        {
+            case styleBackward:  // 0, n-1, n-2, ..., 1
+            {
+                order[count++] = 0;
+                for (int i=steps-1;i>0;i--) order[count++] = uint8_t(i);
+                break;
+            }
+            case stylePingPong:  // 0, 1, ..., n-1, n-2, ..., 1
+            {
+                for (int i=0;i<steps;i++) order[count++] = uint8_t(i);
+                for (int i=steps-2;i>0;i--) order[count++] = uint8_t(i);
+                break;
+            }
+            case styleSpiral:  // n-1, 0, n-2, 1, ... towards the middle
+            {
+                for (int i=0;i<steps;i++)
+                    order[count++] = uint8_t((i % 2) ? i/2 : (2*steps-1-i)/2);
+                break;
+            }
+            case styleStepUpDown:  // +1 for stepsUp-1 times, then -stepsDown
+            {
+                // every position belongs to the substep position % stepsUp,
+                // the cycle ends when index 0 and substep 0 meet again
+                if (stepsUp < 1) stepsUp = 1;
+                stepsDown %= steps;
+                subSteps = stepsUp;
+                int index = 0;
+                do
+                {
+                    order[count] = uint8_t(index);
+                    if (count % stepsUp < stepsUp-1)
+                        index += 1;
+                    else
+                        index -= stepsDown;
+                    if (index >= steps) index -= steps;
+                    if (index < 0) index += steps;
+                    count += 1;
+                } while ((index != 0 || count % stepsUp != 0) && count < MAX_STEP_ORDER_SIZE);
+                break;
+            }
+            default:  // forward
+            {
+                for (int i=0;i<steps;i++) order[count++] = uint8_t(i);
+                break;
+            }
+        }
+    }
+
+    /*
+     * Position of a step index within the cycle, preferring the given substep.
+     * Returns 0 when the index isn't visited by this order.
+     */
+    int find(int index, int subStep = 0) const
+    {
+        int fallback = -1;
+        for (int i=0;i<count;i++)
+        {
+            if (order[i] != index) continue;
+            if (i % subSteps == subStep % subSteps) return i;
+            if (fallback < 0) fallback = i;
+        }
+        return fallback < 0 ? 0 : fallback;
+    }
+
+    // substep belonging to a cursor position (only the step up/down style has more than one)
+    int subStepAt(int position) const { return position % subSteps; }
+
+private:
+    uint8_t order[MAX_STEP_ORDER_SIZE];
+    int count;
+    int subSteps;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef MIDI_PERFOSEQ_TRACE_RING_INCLUDED
+#define MIDI_PERFOSEQ_TRACE_RING_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+
+// power of two, about 100 ms of a busy instance at 256 frames per block
+const uint32_t TRACE_RING_SIZE = 4096;
+
+enum TraceKind {
+    traceBlock,   // time: block start, a: frames, b: events, c: run() nanoseconds
+    traceState,   // a: old machine state, b: new machine state
+    traceStep,    // a: step index, b: step order cursor
+    traceEvent,   // emitted midi event in data
+    traceKindCount
+};
+
+struct TraceRecord {
+    uint64_t time;   // frames since activation
+    int32_t a;
+    int32_t b;
+    uint32_t c;
+    uint8_t kind;
+    uint8_t lane;
+    uint8_t data[3];
+};
+
+/*
+ * Single producer single consumer ring of trace records (build option MIDIPERFOSEQ_TRACE).
+ * run() pushes without locks or allocation; when the ring is full the record is
+ * counted as dropped instead of waiting. A non realtime thread pops and prints.
+ */
+class TraceRing
+{
+public:
+    TraceRing() : writePos(0), readPos(0), dropped(0) {}
+
+    // producer side, audio thread
+    void push(const TraceRecord& record)
+    {
+        const uint32_t write = writePos.load(std::memory_order_relaxed);
+        if (write - readPos.load(std::memory_order_acquire) >= TRACE_RING_SIZE)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        records[write & (TRACE_RING_SIZE-1)] = record;
+        writePos.store(write + 1, std::memory_order_release);
+    }
+
+    // consumer side, non realtime thread
+    bool pop(TraceRecord& record)
+    {
+        const uint32_t read = readPos.load(std::memory_order_relaxed);
+        if (read == writePos.load(std::memory_order_acquire)) return false;
+        record = records[read & (TRACE_RING_SIZE-1)];
+        readPos.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    // records lost since the last call
+    uint32_t takeDropped()
+    {
+        return dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    TraceRecord records[TRACE_RING_SIZE];
+    std::atomic<uint32_t> writePos;
+    std::atomic<uint32_t> readPos;
+    std::atomic<uint32_t> dropped;
+};
+
+#endif
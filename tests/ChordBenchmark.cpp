@@ -0,0 +1,55 @@
+/*
+ * Cost of playing one chord, for 1 to 16 notes per step: records steps of the same size,
+ * then times blocks that press and release one key, which plays a step and releases it.
+ * Prints ns per chord and per note, fails when a chord comes out incomplete.
+ *
+ * usage: chord_benchmark [chords per size]
+ */
+
+#include "TestHost.h"
+#include <chrono>
+
+static const uint32_t BLOCK_SIZE = 64;
+static const int PATTERN_STEPS = 8;
+
+static void recordPattern(TestHost& host, int notes)
+{
+    host.setParameter(bRecord, 1);
+    host.run(BLOCK_SIZE);
+    for (int step=0;step<PATTERN_STEPS;step++)
+    {
+        std::vector<MidiEvent> events;
+        for (int note=0;note<notes;note++) events.push_back(midiEvent(note, 0x90, 36 + 2*step + note*3, 100));
+        for (int note=0;note<notes;note++) events.push_back(midiEvent(BLOCK_SIZE/2 + note, 0x80, 36 + 2*step + note*3));
+        host.run(BLOCK_SIZE, events);
+    }
+    host.setParameter(bRecord, 0);
+    host.run(BLOCK_SIZE);
+}
+
+int main(int argc, char** argv)
+{
+    const int chords = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const std::vector<MidiEvent> stepKey = { midiEvent(0, 0x90, 24, 100), midiEvent(BLOCK_SIZE/2, 0x80, 24) };
+
+    std::printf("notes  ns/chord  ns/note\n");
+    for (int notes=1;notes<=MAX_NOTES_PER_STEP;notes++)
+    {
+        TestHost host;
+        host.activate();
+        recordPattern(host, notes);
+        host.output.clear();
+        host.output.reserve(std::size_t(chords) * 2 * notes);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int chord=0;chord<chords;chord++) host.run(BLOCK_SIZE, stepKey);
+        const auto end = std::chrono::steady_clock::now();
+        host.deactivate();
+
+        TEST_CHECK(host.hostErrors == 0);
+        TEST_CHECK(host.output.size() == std::size_t(chords) * 2 * notes);
+        const double ns = std::chrono::duration<double, std::nano>(end - start).count() / chords;
+        std::printf("%5d  %8.1f  %7.1f\n", notes, ns, ns / notes);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Floods of pitch bend, channel pressure and controllers, more than a block holds in
+ * any host buffer, while the sequencer plays: every one of them comes out, in the order
+ * it came in, and nothing is dropped. Prints the longest block.
+ *
+ * usage: controller_flood_test [blocks] [events per block] [longest block in us, 0 for any]
+ */
+
+#include "TestHost.h"
+#include <chrono>
+
+static const uint32_t BLOCK_SIZE = 256;
+
+static void recordPattern(TestHost& host)
+{
+    host.setParameter(bRecord, 1);
+    host.run(BLOCK_SIZE);
+    for (uint8_t step=0;step<4;step++)
+        host.run(BLOCK_SIZE, { midiEvent(1, 0x90, 48+step, 100), midiEvent(2, 0x90, 55+step, 100),
+                               midiEvent(10, 0x80, 48+step), midiEvent(11, 0x80, 55+step) });
+    host.setParameter(bRecord, 0);
+    host.run(BLOCK_SIZE);
+}
+
+static bool isNote(uint8_t status)
+{
+    return (status & 0xF0) == 0x80 || (status & 0xF0) == 0x90;
+}
+
+int main(int argc, char** argv)
+{
+    const int blocks = argc > 1 ? std::atoi(argv[1]) : 20;
+    const int eventCount = argc > 2 ? std::atoi(argv[2]) : 10000;
+    const double limit = argc > 3 ? std::atof(argv[3]) : 0.0;
+
+    TestHost host;
+    host.activate();
+    host.timePosition().playing = true;
+    recordPattern(host);
+
+    // the flood, a few key presses in between step the pattern
+    std::vector<MidiEvent> events;
+    std::vector<TimedEvent> sent;
+    for (int i=0;i<eventCount;i++)
+    {
+        const uint32_t frame = uint32_t(uint64_t(i) * BLOCK_SIZE / eventCount);
+        if (i % 2500 == 1250) events.push_back(midiEvent(frame, 0x90, 24, 100));
+        if (i % 2500 == 2400) events.push_back(midiEvent(frame, 0x80, 24));
+        const uint8_t channel = uint8_t(i % 3);
+        switch (i % 3)
+        {
+            case 0: events.push_back(midiEvent(frame, 0xE0 | channel, uint8_t(i & 127), uint8_t(64 + (i >> 7) % 32))); break;
+            case 1: events.push_back(midiEvent(frame, 0xD0 | channel, uint8_t(i & 127))); break;
+            default: events.push_back(midiEvent(frame, 0xB0 | channel, 1, uint8_t(i & 127))); break;
+        }
+        const MidiEvent& event = events.back();
+        sent.push_back({ 0, event.data[0], event.data[1], event.size > 2 ? event.data[2] : uint8_t(0) });
+    }
+
+    double longest = 0.0;
+    for (int block=0;block<blocks;block++)
+    {
+        host.output.clear();
+        const auto start = std::chrono::steady_clock::now();
+        host.run(BLOCK_SIZE, events);
+        const auto end = std::chrono::steady_clock::now();
+        longest = std::max(longest, std::chrono::duration<double, std::micro>(end - start).count());
+
+        std::size_t delivered = 0;
+        bool notes = false;
+        for (const TimedEvent& event : host.output)
+        {
+            if (isNote(event.status))
+            {
+                notes = true;
+                continue;
+            }
+            TEST_CHECK(delivered < sent.size());
+            const TimedEvent& expected = sent[delivered++];
+            TEST_CHECK(event.status == expected.status && event.data1 == expected.data1 && event.data2 == expected.data2);
+        }
+        TEST_CHECK(delivered == sent.size());
+        TEST_CHECK(notes);
+    }
+    host.deactivate();
+
+    TEST_CHECK(host.hostErrors == 0);
+    TEST_CHECK(host.parameter(droppedEvents) == 0);
+    std::printf("%d blocks of %d controller events, longest block %.1f us\n", blocks, eventCount, longest);
+    TEST_CHECK(limit <= 0.0 || longest <= limit);
+    return 0;
+}
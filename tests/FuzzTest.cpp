@@ -0,0 +1,559 @@
+/*
+ * Randomized tests of the sequencer, every seed is one replayable case:
+ *
+ *  - reference: a recorded pattern is played by randomly pressed keys in key clock mode
+ *    while the transposition changes, and the output is compared with a simple model
+ *    of the sequencer, the way it was specified before the tables and the scheduler.
+ *  - chaos: random midi and parameter streams, slot restores and reactivations. The same
+ *    stream is run in two random block splits which must give the same output (unless it
+ *    uses the midi clock), with its events in order, none dropped and no note left on
+ *    once every key is released.
+ *
+ * Build it with MIDIPERFOSEQ_SELF_CHECK, then the sequencer checks its invariants in every
+ * block too, and with MIDIPERFOSEQ_SANITIZE to run it under the sanitizers.
+ *
+ * usage: fuzz_test [--seed N] [--seeds FIRST COUNT] [corpus file...]
+ * A corpus file holds one seed per line, # starts a comment.
+ */
+
+#include "TestHost.h"
+#include "MidiLearn.h"
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+
+// -----------------------------------------------------------------------------------------------------------
+// reference
+
+struct ModelNote {
+    uint8_t channel;
+    uint8_t note;
+    uint8_t velocity;
+};
+
+/*
+ * The sequencer in key clock mode with one lane: the first key down plays the step
+ * at the sequencer index, the last key up releases it and moves the index on.
+ * In an overdub take replacing steps the keys of a chord replace the step it plays,
+ * the pattern plays on unchanged until the take ends.
+ */
+class ReferenceSequencer
+{
+public:
+    ReferenceSequencer(const std::vector<std::vector<ModelNote>>& pattern, int style, int stepsUp, int stepsDown)
+        : steps(pattern), sequencerStyle(style), subStepsUp(stepsUp), subStepsDown(stepsDown) {}
+
+    void keyDown(uint64_t time, uint8_t key, uint8_t velocity)
+    {
+        if (! keys.insert(key).second) return;
+        if (taking)
+        {
+            if (keys.size() == 1) take[index].clear();
+            take[index].push_back({ 0, key, velocity });
+        }
+        if (keys.size() != 1) return;
+        for (const ModelNote& note : steps[index])
+        {
+            const ModelNote sounding = { note.channel, uint8_t(note.note + transpose), note.velocity };
+            chord.push_back(sounding);
+            expected.push_back({ time, uint8_t(0x90 | sounding.channel), sounding.note, sounding.velocity });
+        }
+    }
+
+    void keyUp(uint64_t time, uint8_t key)
+    {
+        if (keys.erase(key) == 0 || ! keys.empty()) return;
+        // the chord is released note by note, a frame apart
+        for (std::size_t i=0;i<chord.size();i++)
+            expected.push_back({ time + i, uint8_t(0x80 | chord[i].channel), chord[i].note, chord[i].velocity });
+        chord.clear();
+        next();
+    }
+
+    void beginTake()
+    {
+        take = steps;
+        taking = true;
+    }
+
+    void endTake()
+    {
+        steps = take;
+        taking = false;
+    }
+
+    int transpose = 0;
+    std::vector<TimedEvent> expected;
+
+private:
+    // the styles as they are described in the parameter list
+    void next()
+    {
+        const int size = int(steps.size());
+        switch (sequencerStyle)
+        {
+            case styleForward:
+                index = (index + 1) % size;
+                break;
+            case styleBackward:
+                index = (index + size - 1) % size;
+                break;
+            case stylePingPong:
+                // 0 1 .. n-1 n-2 .. 1 0 1 ..
+                if (size == 1) break;
+                if (index + direction < 0 || index + direction >= size) direction = -direction;
+                index += direction;
+                break;
+            case styleSpiral:
+                // from the outside in: n-1 0 n-2 1 .., the first step is the 0 in it
+                position = (position + 1) % size;
+                index = position % 2 ? position/2 : size - 1 - position/2;
+                break;
+            case styleStepUpDown:
+                // stepsUp-1 steps forward, then stepsDown back
+                if (subStep < subStepsUp - 1) index += 1;
+                else index -= subStepsDown;
+                subStep = (subStep + 1) % subStepsUp;
+                index = ((index % size) + size) % size;
+                break;
+        }
+    }
+
+    std::vector<std::vector<ModelNote>> steps;
+    std::vector<std::vector<ModelNote>> take;
+    bool taking = false;
+    int sequencerStyle;
+    int subStepsUp;
+    int subStepsDown;
+    int index = 0;
+    int direction = 1;
+    int position = 1;
+    int subStep = 0;
+    std::set<uint8_t> keys;
+    std::vector<ModelNote> chord;
+};
+
+/*
+ * Timed input for the host: midi events and parameter changes at absolute times.
+ * Parameter changes take effect with the block starting at their time.
+ */
+struct TimedInput {
+    uint64_t time;
+    bool parameter;
+    MidiEvent event;
+    uint32_t index;
+    float value;
+};
+
+static void runInput(TestHost& host, std::vector<TimedInput>& input, uint64_t end, std::mt19937& random)
+{
+    std::stable_sort(input.begin(), input.end(), [](const TimedInput& a, const TimedInput& b) { return a.time < b.time; });
+    std::size_t next = 0;
+    while (host.time < end)
+    {
+        while (next < input.size() && input[next].parameter && input[next].time <= host.time)
+        {
+            host.setParameter(input[next].index, input[next].value);
+            next += 1;
+        }
+        uint64_t blockEnd = std::min(end, host.time + 1 + random() % 512);
+        std::vector<MidiEvent> events;
+        for (std::size_t i=next;i<input.size() && input[i].time < blockEnd;i++)
+        {
+            if (input[i].parameter)
+            {
+                blockEnd = input[i].time;
+                break;
+            }
+            MidiEvent event = input[i].event;
+            event.frame = uint32_t(input[i].time - host.time);
+            events.push_back(event);
+        }
+        next += events.size();
+        host.run(uint32_t(blockEnd - host.time), events);
+    }
+}
+
+static bool sameEvents(const TimedEvent& a, const TimedEvent& b)
+{
+    return a.time == b.time && a.status == b.status && a.data1 == b.data1 && a.data2 == b.data2;
+}
+
+static bool firstDifference(unsigned seed, const char* test, const std::vector<TimedEvent>& expected,
+                            const std::vector<TimedEvent>& output)
+{
+    std::size_t i = 0;
+    while (i < expected.size() && i < output.size() && sameEvents(expected[i], output[i])) i++;
+    if (i == expected.size() && i == output.size()) return false;
+    std::fprintf(stderr, "seed %u, %s: event %zu of %zu/%zu differs:", seed, test, i, expected.size(), output.size());
+    if (i < expected.size())
+        std::fprintf(stderr, " expected %02x %d %d at %llu,", expected[i].status, expected[i].data1, expected[i].data2,
+                     (unsigned long long)expected[i].time);
+    if (i < output.size())
+        std::fprintf(stderr, " got %02x %d %d at %llu", output[i].status, output[i].data1, output[i].data2,
+                     (unsigned long long)output[i].time);
+    std::fprintf(stderr, "\n");
+    return true;
+}
+
+/*
+ * An overdub take replacing steps: chords of new notes on the first channel, each one
+ * plays the step at the cursor and takes its place in the pattern once the take ends.
+ */
+static void replaceStepsTake(TestHost& host, ReferenceSequencer& model, uint64_t& time, std::mt19937& random)
+{
+    std::vector<TimedInput> input;
+    input.push_back({ time, true, MidiEvent(), overdub, 1.0f });
+    input.push_back({ time, true, MidiEvent(), replaceSteps, 1.0f });
+    input.push_back({ time, true, MidiEvent(), bRecord, 1.0f });
+    model.beginTake();
+    for (int chord=1+random()%8;chord>0;chord--)
+    {
+        time += MAX_NOTES_PER_STEP + random() % 200;
+        std::set<uint8_t> keys;
+        for (int count=1+random()%4;count>0;count--) keys.insert(uint8_t(36 + random() % 60));
+        for (uint8_t key : keys)
+        {
+            const uint8_t velocity = uint8_t(1 + random() % 127);
+            input.push_back({ time, false, midiEvent(0, 0x90, key, velocity), 0, 0.0f });
+            model.keyDown(time, key, velocity);
+        }
+        time += 1 + random() % 200;
+        for (uint8_t key : keys)
+        {
+            input.push_back({ time, false, midiEvent(0, 0x80, key), 0, 0.0f });
+            model.keyUp(time, key);
+        }
+    }
+    time += MAX_NOTES_PER_STEP;
+    input.push_back({ time, true, MidiEvent(), bRecord, 0.0f });
+    input.push_back({ time, true, MidiEvent(), overdub, 0.0f });
+    model.endTake();
+    time += 1 + random() % 300;
+    runInput(host, input, time, random);
+}
+
+static bool referenceCase(unsigned seed)
+{
+    std::mt19937 random(seed);
+    TestHost host;
+    host.activate();
+    host.timePosition().playing = true;
+
+    // the pattern: chords of 1..6 notes with all onsets on one frame
+    std::vector<std::vector<ModelNote>> pattern(random() % 4 == 0 ? 1 : 1 + random() % 12);
+    for (std::vector<ModelNote>& step : pattern)
+    {
+        std::set<int> pitches;
+        for (int count=1+random()%6;count>0;count--)
+        {
+            const ModelNote note = { uint8_t(random() % 4), uint8_t(36 + random() % 60), uint8_t(1 + random() % 127) };
+            if (pitches.insert(note.channel * 128 + note.note).second) step.push_back(note);
+        }
+    }
+    const int style = random() % (styleStepUpDown + 1);
+    const int stepsUp = 1 + random() % MAX_SEQUENCER_STEPS_SIZE;
+    const int stepsDown = 1 + random() % MAX_SEQUENCER_STEPS_SIZE;
+    host.setParameter(seqStyle, style);
+    host.setParameter(seqStepsUp, stepsUp);
+    host.setParameter(seqStepsDown, stepsDown);
+
+    std::vector<TimedInput> input;
+    uint64_t time = 64;
+    input.push_back({ time, true, MidiEvent(), bRecord, 1.0f });
+    for (const std::vector<ModelNote>& step : pattern)
+    {
+        time += 1 + random() % 300;
+        for (const ModelNote& note : step)
+            input.push_back({ time, false, midiEvent(0, 0x90 | note.channel, note.note, note.velocity), 0, 0.0f });
+        time += 1 + random() % 300;
+        for (const ModelNote& note : step)
+            input.push_back({ time, false, midiEvent(0, 0x80 | note.channel, note.note), 0, 0.0f });
+    }
+    time += 1 + random() % 300;
+    input.push_back({ time, true, MidiEvent(), bRecord, 0.0f });
+    time += 1 + random() % 300;
+    runInput(host, input, time, random);
+    TEST_CHECK(host.parameter(groupNumber) == float(pattern.size()));
+    host.output.clear();
+
+    // every other seed replaces steps first, with a generator of its own for the same keys below
+    ReferenceSequencer model(pattern, style, stepsUp, stepsDown);
+    if (seed % 2 == 0)
+    {
+        std::mt19937 takeRandom(seed ^ 0x5eedu);
+        replaceStepsTake(host, model, time, takeRandom);
+        TEST_CHECK(host.parameter(groupNumber) == float(pattern.size()));
+    }
+
+    // playing: keys go down and up, sometimes overlapping, while the transposition changes
+    input.clear();
+    const uint64_t start = time;
+    std::set<uint8_t> held;
+    for (int action=0;action<300;action++)
+    {
+        time += 1 + random() % 200;
+        if (random() % 8 == 0)
+        {
+            // the transposition of the next block, the model takes it for the steps from then on
+            input.push_back({ time, true, MidiEvent(), transposeSemi, float(int(random() % 25) - 12) });
+            continue;
+        }
+        const uint8_t key = uint8_t(60 + random() % 4);
+        if (held.erase(key))
+            input.push_back({ time, false, random() % 3 ? midiEvent(0, 0x80, key) : midiEvent(0, 0x90, key, 0), 0, 0.0f });
+        else if (held.size() < 3)
+        {
+            // a chord is released a frame per note, the next one starts after it
+            time += MAX_NOTES_PER_STEP;
+            input.push_back({ time, false, midiEvent(0, 0x90, key, 1 + random() % 127), 0, 0.0f });
+            held.insert(key);
+        }
+    }
+    time += MAX_NOTES_PER_STEP;
+    for (uint8_t key : held) input.push_back({ time++, false, midiEvent(0, 0x80, key), 0, 0.0f });
+    time += MAX_NOTES_PER_STEP;
+    std::stable_sort(input.begin(), input.end(), [](const TimedInput& a, const TimedInput& b) { return a.time < b.time; });
+    for (const TimedInput& timed : input)
+    {
+        if (timed.parameter) model.transpose = int(timed.value);
+        else if ((timed.event.data[0] & 0xF0) == 0x90 && timed.event.data[2] > 0) model.keyDown(timed.time, timed.event.data[1], timed.event.data[2]);
+        else model.keyUp(timed.time, timed.event.data[1]);
+    }
+    TEST_CHECK(host.time <= start);
+    runInput(host, input, time, random);
+    host.deactivate();
+
+    TEST_CHECK(host.hostErrors == 0);
+    return ! firstDifference(seed, "reference", model.expected, host.output);
+}
+
+// -----------------------------------------------------------------------------------------------------------
+// chaos
+
+/*
+ * A stretch of the stream: what happens at its start, then its midi events.
+ */
+struct Segment {
+    uint32_t frames;
+    std::vector<std::pair<uint32_t, float>> parameters;
+    bool restorePattern;
+    bool reactivate;
+    bool playing;
+    std::vector<MidiEvent> events;
+};
+
+/*
+ * Odd seeds send midi clock input. Its tempo and its back dated steps are taken
+ * per block, so only the streams of even seeds play the same in any block split.
+ */
+static bool usesMidiClock(unsigned seed)
+{
+    return seed % 2 == 1;
+}
+
+static std::vector<Segment> chaosStream(unsigned seed, std::set<int>& held)
+{
+    std::mt19937 random(seed);
+    std::vector<Segment> stream(1500);
+    for (Segment& segment : stream)
+    {
+        segment.frames = 1 + random() % 512;
+        uint32_t frame = 0;
+        for (int count=random()%6;count>0;count--)
+        {
+            frame += random() % (segment.frames/4 + 1);
+            if (frame >= segment.frames) break;
+            const uint8_t channel = random() % 3;
+            const uint8_t key = 24 + random() % 72;
+            const int heldKey = channel * 128 + key;
+            switch (random() % 10)
+            {
+                case 0: segment.events.push_back(midiEvent(frame, 0xC0 | channel, random() % 10)); break;
+                case 1: segment.events.push_back(midiEvent(frame, 0xB0 | channel, random() % 128, random() % 128)); break;
+                case 2:
+                {
+                    static const uint8_t realtime[4] = { 0xF8, 0xF8, 0xFA, 0xFC };
+                    const uint8_t status = realtime[random() % 4];
+                    if (usesMidiClock(seed)) segment.events.push_back(midiEvent(frame, status));
+                    break;
+                }
+                default:
+                    if (held.erase(heldKey))
+                        segment.events.push_back(random() % 3 ? midiEvent(frame, 0x80 | channel, key)
+                                                              : midiEvent(frame, 0x90 | channel, key, 0));
+                    else
+                    {
+                        segment.events.push_back(midiEvent(frame, 0x90 | channel, key, 1 + random() % 127));
+                        held.insert(heldKey);
+                    }
+                    break;
+            }
+        }
+        std::pair<uint32_t, float> change(parameterCount, 0.0f);
+        switch (random() % 40)
+        {
+            case 0: change = { bRecord, float(random() % 2) }; break;
+            case 1: change = { bReset, float(random() % 2) }; break;
+            case 2: change = { seqStyle, float(random() % styleCount) }; break;
+            case 3: change = { seqStepsUp, float(1 + random() % 16) }; break;
+            case 4: change = { seqStepsDown, float(1 + random() % 16) }; break;
+            case 5: change = { clockMode, float(random() % clockModeCount) }; break;
+            case 6: change = { clockRate, float(random() % clockRateCount) }; break;
+            case 7: change = { laneMode, float(random() % laneModeCount) }; break;
+            case 8: change = { laneSplit1 + random() % 3, float(24 + random() % 72) }; break;
+            case 9: change = { transposeKey, float(random() % 3) }; break;
+            case 10: change = { transposeSemi, float(int(random() % 25) - 12) }; break;
+            case 11: change = { patternSlot, float(random() % MAX_PATTERN_SLOTS) }; break;
+            case 12: change = { gateLength, float(1 + random() % 100) }; break;
+            case 13: change = { ratchetCount, float(1 + random() % 16) }; break;
+            case 14: change = { ratchetRate, float(random() % clockRateCount) }; break;
+            case 15: change = { ratchetDecay, float(random() % 101) }; break;
+            case 16: change = { strumScale, float(random() % 401) }; break;
+            case 17: change = { scaleType, float(random() % scaleTypeCount) }; break;
+            case 18: change = { scaleRoot, float(random() % 12) }; break;
+            case 19: change = { learnTarget, float(random() % 4 ? 0 : random() % (learnFirstParameter + parameterCount)) }; break;
+            case 20: change = { learnFilter, float(random() % 2) }; break;
+            case 21: change = { overdub, float(random() % 2) }; break;
+            case 22: change = { replaceSteps, float(random() % 2) }; break;
+            case 23: change = { transposeKeyBase, float(36 + random() % 48) }; break;
+            case 24: change = { seqSeed, float(random() % 65536) }; break;
+            default: break;
+        }
+        if (change.first < parameterCount) segment.parameters.push_back(change);
+        segment.restorePattern = random() % 40 == 0;
+        segment.reactivate = random() % 400 == 0;
+        segment.playing = random() % 20 != 0;
+    }
+    return stream;
+}
+
+/*
+ * Runs a stream with every segment split into blocks at random, then releases the keys
+ * still held and lets the notes ring out.
+ */
+static void runChaos(TestHost& host, const std::vector<Segment>& stream, const std::set<int>& held, std::mt19937& split)
+{
+    host.activate();
+    for (const Segment& segment : stream)
+    {
+        for (const std::pair<uint32_t, float>& change : segment.parameters) host.setParameter(change.first, change.second);
+        if (segment.restorePattern)
+        {
+            const DISTRHO::String pattern = host.state("pattern");
+            host.setState("pattern", pattern);
+        }
+        if (segment.reactivate)
+        {
+            host.deactivate();
+            host.activate();
+        }
+        host.timePosition().playing = segment.playing;
+        std::size_t next = 0;
+        for (uint32_t done=0;done<segment.frames;)
+        {
+            const uint32_t frames = split() % 2 ? segment.frames - done : std::min(segment.frames - done, uint32_t(1 + split() % 128));
+            std::vector<MidiEvent> events;
+            for (;next<segment.events.size() && segment.events[next].frame < done + frames;next++)
+            {
+                events.push_back(segment.events[next]);
+                events.back().frame -= done;
+            }
+            host.run(frames, events);
+            done += frames;
+        }
+    }
+    std::vector<MidiEvent> releases;
+    for (int key : held) releases.push_back(midiEvent(uint32_t(releases.size()), 0x80 | (key / 128), key % 128));
+    host.setParameter(clockMode, clockKeys);
+    host.run(512, releases);
+    host.idle(200 * 512, 512);
+    host.deactivate();
+}
+
+static bool chaosCase(unsigned seed)
+{
+    std::set<int> held;
+    const std::vector<Segment> stream = chaosStream(seed, held);
+    TestHost whole, split;
+    std::mt19937 wholeSplit(0), randomSplit(seed);
+    runChaos(whole, stream, held, wholeSplit);
+    runChaos(split, stream, held, randomSplit);
+
+    bool passed = true;
+    if (whole.hostErrors + split.hostErrors > 0)
+    {
+        std::fprintf(stderr, "seed %u, chaos: %d events out of order or block\n", seed, whole.hostErrors + split.hostErrors);
+        passed = false;
+    }
+    if (whole.parameter(droppedEvents) + split.parameter(droppedEvents) > 0.0f)
+    {
+        std::fprintf(stderr, "seed %u, chaos: events dropped\n", seed);
+        passed = false;
+    }
+    SoundingNotes sounding;
+    sounding.add(whole.output);
+    for (const std::pair<int, int>& note : sounding.all())
+    {
+        std::fprintf(stderr, "seed %u, chaos: channel %d note %d left on\n", seed, note.first + 1, note.second);
+        passed = false;
+    }
+    if (! usesMidiClock(seed) && firstDifference(seed, "chaos split", whole.output, split.output)) passed = false;
+    return passed;
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
+static bool runSeed(unsigned seed)
+{
+    const bool reference = referenceCase(seed);
+    const bool chaos = chaosCase(seed);
+    return reference && chaos;
+}
+
+static bool readCorpus(const char* path, std::vector<unsigned>& seeds)
+{
+    std::ifstream file(path);
+    if (! file) return false;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        unsigned seed;
+        if (fields >> seed) seeds.push_back(seed);
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<unsigned> seeds;
+    for (int i=1;i<argc;i++)
+    {
+        if (std::strcmp(argv[i], "--seed") == 0 && i+1 < argc)
+            seeds.push_back(unsigned(std::strtoul(argv[++i], nullptr, 10)));
+        else if (std::strcmp(argv[i], "--seeds") == 0 && i+2 < argc)
+        {
+            const unsigned first = unsigned(std::strtoul(argv[++i], nullptr, 10));
+            const unsigned count = unsigned(std::strtoul(argv[++i], nullptr, 10));
+            for (unsigned seed=first;seed<first+count;seed++) seeds.push_back(seed);
+        }
+        else if (! readCorpus(argv[i], seeds))
+        {
+            std::fprintf(stderr, "can't read the corpus %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (seeds.empty())
+    {
+        std::fprintf(stderr, "usage: fuzz_test [--seed N] [--seeds FIRST COUNT] [corpus file...]\n");
+        return 2;
+    }
+    int failed = 0;
+    for (unsigned seed : seeds)
+        if (! runSeed(seed)) failed += 1;
+    std::printf("%zu seeds, %d failed\n", seeds.size(), failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+/*
+ * Midi clock mode: a start plays the pattern from its first step in the order of the
+ * style, a stop silences the lanes until the next start, while the key stays held.
+ * The host transport stopping in host clock mode ends the repeats like a midi stop.
+ */
+
+#include "TestHost.h"
+
+// 120 bpm at 48 kHz: a clock every 1000 frames, a sixteenth step every 6 clocks
+static const uint32_t CLOCK_FRAMES = 1000;
+
+static void recordPattern(TestHost& host, const std::vector<uint8_t>& notes)
+{
+    host.setParameter(bRecord, 1);
+    host.run(256);
+    for (uint8_t note : notes) host.run(256, { midiEvent(1, 0x90, note, 100), midiEvent(10, 0x80, note) });
+    host.setParameter(bRecord, 0);
+    host.run(256);
+}
+
+// runs a block per clock, the first one may carry a start, stop or continue before its clock
+static void clocks(TestHost& host, int count, uint8_t command = 0)
+{
+    for (int i=0;i<count;i++)
+    {
+        std::vector<MidiEvent> events;
+        if (i == 0 && command != 0) events.push_back(midiEvent(0, command));
+        events.push_back(midiEvent(0, 0xF8));
+        host.run(CLOCK_FRAMES, events);
+    }
+}
+
+static std::vector<uint8_t> notesOn(const std::vector<TimedEvent>& output)
+{
+    std::vector<uint8_t> notes;
+    for (const TimedEvent& event : output)
+        if ((event.status & 0xF0) == 0x90 && event.data2 > 0) notes.push_back(event.data1);
+    return notes;
+}
+
+static void startAfterStyleChange()
+{
+    TestHost host;
+    host.activate();
+    recordPattern(host, { 60, 62, 64, 65 });
+    host.setParameter(clockMode, clockMidi);
+    host.run(256, { midiEvent(0, 0x90, 48, 100) });
+
+    host.output.clear();
+    clocks(host, 24, 0xFA);
+    TEST_CHECK(notesOn(host.output) == std::vector<uint8_t>({ 60, 62, 64, 65 }));
+
+    // stopped: no steps while the clock runs on, the last step ends with its gate
+    host.output.clear();
+    clocks(host, 12, 0xFC);
+    TEST_CHECK(notesOn(host.output).empty());
+    SoundingNotes sounding;
+    sounding.add(host.output);
+    TEST_CHECK(sounding.empty());
+
+    // the spiral goes on from the first step with the third, the second and the last
+    host.setParameter(seqStyle, styleSpiral);
+    host.output.clear();
+    clocks(host, 24, 0xFA);
+    TEST_CHECK(notesOn(host.output) == std::vector<uint8_t>({ 60, 64, 62, 65 }));
+
+    // and again from the first step with the next start, the cursor is placed on it in the order
+    host.output.clear();
+    clocks(host, 12, 0xFC);
+    clocks(host, 24, 0xFA);
+    TEST_CHECK(notesOn(host.output) == std::vector<uint8_t>({ 60, 64, 62, 65 }));
+
+    host.run(256, { midiEvent(0, 0x80, 48) });
+    host.idle(12 * CLOCK_FRAMES);
+    TEST_CHECK(host.hostErrors == 0);
+}
+
+static void transportStopEndsRepeats()
+{
+    TestHost host;
+    host.activate();
+    recordPattern(host, { 60 });
+    host.setParameter(clockMode, clockHost);
+    host.setParameter(clockRate, rateQuarter);
+    host.setParameter(gateLength, 100);
+    host.setParameter(ratchetCount, 8);
+    host.timePosition().playing = true;
+    host.run(256, { midiEvent(0, 0x90, 48, 100) });
+    host.idle(24000, 1000);
+    TEST_CHECK(! notesOn(host.output).empty());
+
+    // the repeats of the step would go on for the rest of its quarter
+    host.timePosition().playing = false;
+    host.output.clear();
+    host.idle(24000, 1000);
+    TEST_CHECK(notesOn(host.output).empty());
+    host.run(256, { midiEvent(0, 0x80, 48) });
+    TEST_CHECK(host.hostErrors == 0);
+}
+
+int main()
+{
+    startAfterStyleChange();
+    transportStopEndsRepeats();
+    std::printf("midi clock start and stop\n");
+    return 0;
+}
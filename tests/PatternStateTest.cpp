@@ -0,0 +1,56 @@
+/*
+ * Settings saved with the pattern state come back as they were, at the limits of their
+ * ranges too, and states of the earlier 16 bit encoding still read right.
+ */
+
+#include "TestHost.h"
+#include "PatternState.h"
+
+static void roundTrip(uint32_t index, float value)
+{
+    TestHost saved;
+    saved.activate();
+    saved.setParameter(index, value);
+    saved.run(64);
+    const DISTRHO::String state = saved.state("pattern");
+
+    TestHost restored;
+    restored.activate();
+    restored.setState("pattern", state);
+    restored.run(64);
+    if (restored.parameter(index) != value)
+        std::fprintf(stderr, "parameter %u: saved %g, restored %g\n", index, double(value), double(restored.parameter(index)));
+    TEST_CHECK(restored.parameter(index) == value);
+}
+
+/*
+ * A version 3 state with a wrapped seed and a negative transposition.
+ */
+static void readVersion3()
+{
+    const uint8_t data[] = { 'M', 'P', 'S', 3,
+                             2, seqSeed, 0x40, 0x9C, transposeSemi, 0xFB, 0xFF,
+                             0, 0, 1,
+                             1, 1, 0x90, 60, 100, 0, 0 };
+    PatternStore pattern;
+    PatternStore* const slots[1] = { &pattern };
+    PatternSetting settings[parameterCount];
+    int slotCount = 0;
+    int playingSlot = 0;
+    int stepIndex = 0;
+    int settingCount = 0;
+    TEST_CHECK(decodePatternState(data, int(sizeof(data)), slots, 1, slotCount, playingSlot, stepIndex, settings, settingCount));
+    TEST_CHECK(settingCount == 2);
+    TEST_CHECK(settings[0].index == seqSeed && settings[0].value == 40000);
+    TEST_CHECK(settings[1].index == transposeSemi && settings[1].value == -5);
+    TEST_CHECK(slotCount == 1 && pattern.size() == 1 && pattern.stepNotes(0)->note == 60);
+}
+
+int main()
+{
+    for (float seed : { 0.0f, 1.0f, 32767.0f, 32768.0f, 40000.0f, 65535.0f }) roundTrip(seqSeed, seed);
+    for (float semi : { -12.0f, 12.0f }) roundTrip(transposeSemi, semi);
+    readVersion3();
+    std::printf("pattern state settings round trip\n");
+    return 0;
+}
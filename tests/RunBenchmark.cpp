@@ -0,0 +1,227 @@
+/*
+ * Offline render of run() for regression numbers: records a pattern, synthetic or
+ * from a midi file, and plays it with a stream of keys and controllers, block after block.
+ * Prints events/s, mean ns per block and the p50/p99/max block for every block size,
+ * sequencer style, keypress action and pattern size, then the same for a controller flood.
+ * Fails when the host sees a block out of order or events are dropped.
+ *
+ * usage: perfoseq_benchmark [--blocks N] [--block-sizes 64,256,...] [--steps 1,8,...]
+ *                           [--styles 0,1,...] [--actions 0,1,2] [--keys N] [--controllers N]
+ *                           [--flood N] [--smf file.mid]
+ */
+
+#include "TestHost.h"
+#include "MidiFile.h"
+#include <cstring>
+#include <string>
+
+static const uint32_t RECORD_BLOCK_SIZE = 64;
+static const int BASE_KEY = 48;  // the keys played go up from the transpose base key
+
+static const char* const styleNames[styleCount] = {
+    "forward", "backward", "ping pong", "spiral", "step up/down", "random", "no repeat", "weighted"
+};
+static const char* const actionNames[3] = { "none", "follow", "one key" };
+
+struct Options {
+    int blocks = 2000;
+    std::vector<int> blockSizes = { 64, 256, 1024 };
+    std::vector<int> steps = { 1, 8, 32, MAX_NOTE_ON_GROUPS };
+    std::vector<int> styles;
+    std::vector<int> actions = { 0, 1, 2 };  // keypress actions: no transposition, follow key, only one key
+    int keys = 4;          // key presses per block, each released within the block
+    int controllers = 16;  // channel pressure and controllers per block
+    int flood = 10000;     // controller events per block of the flood, 0: no flood
+    const char* smf = nullptr;
+};
+
+static std::vector<int> parseList(const char* text)
+{
+    std::vector<int> values;
+    for (const char* p=text;*p;)
+    {
+        values.push_back(std::atoi(p));
+        p = std::strchr(p, ',');
+        if (p == nullptr) break;
+        p += 1;
+    }
+    return values;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options)
+{
+    for (int i=1;i<argc;i++)
+    {
+        const std::string option(argv[i]);
+        if (i+1 >= argc) return false;
+        const char* value = argv[++i];
+        if (option == "--blocks") options.blocks = std::atoi(value);
+        else if (option == "--block-sizes") options.blockSizes = parseList(value);
+        else if (option == "--steps") options.steps = parseList(value);
+        else if (option == "--styles") options.styles = parseList(value);
+        else if (option == "--actions") options.actions = parseList(value);
+        else if (option == "--keys") options.keys = std::atoi(value);
+        else if (option == "--controllers") options.controllers = std::atoi(value);
+        else if (option == "--flood") options.flood = std::atoi(value);
+        else if (option == "--smf") options.smf = value;
+        else return false;
+    }
+    if (options.styles.empty())
+        for (int style=0;style<styleCount;style++) options.styles.push_back(style);
+    return options.blocks > 0;
+}
+
+/*
+ * A synthetic pattern: steps of 1 to 4 notes spread over four octaves.
+ */
+static PatternStore* syntheticPattern(int steps)
+{
+    PatternStore* pattern = new PatternStore();
+    for (int step=0;step<steps && pattern->appendStep();step++)
+        for (int note=0;note<=step%4;note++)
+            pattern->appendNote({ 0x90, uint8_t(36 + (step*7) % 48 + note*4), uint8_t(64 + step % 64), 0 });
+    return pattern;
+}
+
+/*
+ * Records the steps of a pattern by playing them, a block per step.
+ */
+static void recordPattern(TestHost& host, const PatternStore& pattern)
+{
+    host.setParameter(bRecord, 1);
+    host.run(RECORD_BLOCK_SIZE);
+    for (int step=0;step<pattern.size();step++)
+    {
+        const PatternNote* notes = pattern.stepNotes(step);
+        const int length = pattern.stepLength(step);
+        std::vector<MidiEvent> events;
+        for (int note=0;note<length;note++)
+            events.push_back(midiEvent(uint32_t(note), notes[note].status, notes[note].note, notes[note].velocity));
+        for (int note=0;note<length;note++)
+            events.push_back(midiEvent(RECORD_BLOCK_SIZE/2 + uint32_t(note), uint8_t(0x80 | (notes[note].status & 0x0F)), notes[note].note));
+        host.run(RECORD_BLOCK_SIZE, events);
+    }
+    host.setParameter(bRecord, 0);
+    host.run(RECORD_BLOCK_SIZE);
+}
+
+/*
+ * One block of input: key presses released half way to the next one, with
+ * channel pressure, pitch bend and controllers spread over the block in between.
+ */
+static std::vector<MidiEvent> inputBlock(uint32_t frames, int keys, int controllers)
+{
+    std::vector<MidiEvent> events;
+    std::vector<MidiEvent> keyEvents;
+    for (int key=0;key<keys;key++)
+    {
+        const uint32_t frame = uint32_t(uint64_t(key) * frames / keys);
+        const uint32_t release = uint32_t(uint64_t(2*key+1) * frames / (2*keys));
+        keyEvents.push_back(midiEvent(frame, 0x90, uint8_t(BASE_KEY + key % 12), 100));
+        keyEvents.push_back(midiEvent(std::max(release, frame), 0x80, uint8_t(BASE_KEY + key % 12)));
+    }
+    std::size_t nextKey = 0;
+    for (int i=0;i<controllers;i++)
+    {
+        const uint32_t frame = uint32_t(uint64_t(i) * frames / controllers);
+        while (nextKey < keyEvents.size() && keyEvents[nextKey].frame <= frame) events.push_back(keyEvents[nextKey++]);
+        switch (i % 3)
+        {
+            case 0: events.push_back(midiEvent(frame, 0xD0, uint8_t(i & 127))); break;
+            case 1: events.push_back(midiEvent(frame, 0xE0, 0, uint8_t(i & 127))); break;
+            default: events.push_back(midiEvent(frame, 0xB0, uint8_t(1 + i % 8), uint8_t(i & 127))); break;
+        }
+    }
+    while (nextKey < keyEvents.size()) events.push_back(keyEvents[nextKey++]);
+    return events;
+}
+
+/*
+ * Plays the input block again and again, one line of block times.
+ */
+static void measure(const char* name, int style, int action, const PatternStore& pattern, uint32_t frames,
+                    const std::vector<MidiEvent>& events, int blocks)
+{
+    TestHost host;
+    host.activate();
+    host.timePosition().playing = true;
+    recordPattern(host, pattern);
+    host.setParameter(seqStyle, float(style));
+    host.setParameter(transposeKey, float(action));
+    host.setParameter(transposeKeyBase, float(BASE_KEY));
+    host.output.clear();
+
+    std::vector<double> blockNs;
+    blockNs.reserve(std::size_t(blocks));
+    std::size_t notes = 0;
+    for (int block=0;block<blocks;block++)
+    {
+        host.run(frames, events);
+        blockNs.push_back(double(host.runTime.count()));
+        notes += std::size_t(std::count_if(host.output.begin(), host.output.end(),
+                                           [](const TimedEvent& event) { return (event.status & 0xF0) == 0x90; }));
+        host.output.clear();
+    }
+    host.deactivate();
+
+    TEST_CHECK(host.hostErrors == 0);
+    TEST_CHECK(host.parameter(droppedEvents) == 0);
+    TEST_CHECK(pattern.empty() || events.empty() || notes > 0);
+
+    double total = 0.0;
+    for (double ns : blockNs) total += ns;
+    std::sort(blockNs.begin(), blockNs.end());
+    std::printf("%-12s %-7s %5d %6u %7zu %12.0f %10.0f %10.0f %10.0f %10.0f\n",
+                name, actionNames[action], pattern.size(), frames, events.size(),
+                total > 0.0 ? double(events.size()) * blocks * 1e9 / total : 0.0,
+                total / blocks, blockNs[blockNs.size()/2], blockNs[blockNs.size()*99/100], blockNs.back());
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (! parseOptions(argc, argv, options))
+    {
+        std::fprintf(stderr, "usage: %s [--blocks N] [--block-sizes 64,256,...] [--steps 1,8,...] [--styles 0,1,...]\n"
+                             "          [--actions 0,1,2] [--keys N] [--controllers N] [--flood N] [--smf file.mid]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<PatternStore*> patterns;
+    if (options.smf != nullptr)
+    {
+        patterns.push_back(new PatternStore());
+        if (! importMidiFile(options.smf, *patterns.back()))
+        {
+            std::fprintf(stderr, "can't read midi file %s\n", options.smf);
+            return 2;
+        }
+    }
+    else
+    {
+        for (int steps : options.steps) patterns.push_back(syntheticPattern(std::min(steps, MAX_NOTE_ON_GROUPS)));
+    }
+
+    std::printf("%-12s %-7s %5s %6s %7s %12s %10s %10s %10s %10s\n",
+                "style", "keys", "steps", "frames", "events", "events/s", "ns/block", "p50 ns", "p99 ns", "max ns");
+    for (int frames : options.blockSizes)
+    {
+        const std::vector<MidiEvent> events = inputBlock(uint32_t(frames), options.keys, options.controllers);
+        for (int style : options.styles)
+        {
+            if (style < 0 || style >= styleCount) continue;
+            for (int action : options.actions)
+            {
+                if (action < 0 || action > 2) continue;
+                for (const PatternStore* pattern : patterns)
+                    measure(styleNames[style], style, action, *pattern, uint32_t(frames), events, options.blocks);
+            }
+        }
+        if (options.flood > 0)
+            measure("flood", styleForward, 0, *patterns.back(), uint32_t(frames),
+                    inputBlock(uint32_t(frames), options.keys, options.flood), options.blocks);
+    }
+
+    for (PatternStore* pattern : patterns) delete pattern;
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * The step order tables against the stepping function they replaced: for every style,
+ * pattern length 1..128 and step up/down setting, the cycle of the table is the cycle
+ * the old function steps through.
+ */
+
+#include "StepOrderTable.h"
+#include <cstdio>
+#include <vector>
+
+/*
+ * The sequencer stepping as it was before the tables (getNextSequencerIndex()),
+ * with the pattern size in place of the note on queue.
+ */
+class OldStepping
+{
+public:
+    OldStepping(int style, int size, int subStepsUp, int subStepsDown)
+        : sequencerStyle(style), queueSize(size), sequencerSubStepsUp(subStepsUp), sequencerSubStepsDown(subStepsDown) {}
+
+    int next()
+    {
+        switch (sequencerStyle)
+        {
+            case 0:  // forward
+            {
+                noteOnQueueVectorIndex += 1;
+                break;
+            }
+            case 1:  // backward
+            {
+                noteOnQueueVectorIndex += queueSize;
+                noteOnQueueVectorIndex -= 1;
+                break;
+            }
+            case 2:  // ping pong
+            {
+                if (sequencerStep==0) sequencerStep=1;
+                noteOnQueueVectorIndex += sequencerStep;
+                if (noteOnQueueVectorIndex == queueSize-1) sequencerStep=-1;
+                if (noteOnQueueVectorIndex <=0) sequencerStep=1;
+                break;
+            }
+            case 3:  // spiral
+            {
+                if (sequencerStep %2)
+                {
+                    noteOnQueueVectorIndex = sequencerStep/2;
+                } else
+                {
+                    noteOnQueueVectorIndex = (2*queueSize-1-sequencerStep)/2;
+                }
+                sequencerStep = (sequencerStep + 1) % queueSize;
+                break;
+            }
+            case 4:  // +sequencerSubStepsUp -sequencerSubStepsDown
+            {
+                if (sequencerSubStep<sequencerSubStepsUp-1)
+                    noteOnQueueVectorIndex += 1;
+                else
+                    noteOnQueueVectorIndex -= sequencerSubStepsDown;
+                sequencerSubStep += 1;
+                sequencerSubStep %= sequencerSubStepsUp;
+                noteOnQueueVectorIndex += MAX_SEQUENCER_STEPS_SIZE * queueSize;
+                break;
+            }
+        }
+        noteOnQueueVectorIndex %= queueSize;
+        return noteOnQueueVectorIndex;
+    }
+
+private:
+    int sequencerStyle;
+    int queueSize;
+    int sequencerSubStepsUp;
+    int sequencerSubStepsDown;
+    int noteOnQueueVectorIndex = 0;
+    int sequencerStep = 0;
+    int sequencerSubStep = 0;
+};
+
+static StepOrderTable table;
+
+/*
+ * True when the old stepping, once past its start, runs through the table cycle from some position on.
+ */
+static bool sameCycle(int style, int steps, int stepsUp, int stepsDown)
+{
+    table.build(style, steps, stepsUp, stepsDown);
+    const int length = table.length();
+    if (length < 1 || length > MAX_STEP_ORDER_SIZE) return false;
+    OldStepping old(style, steps, stepsUp, stepsDown);
+    // the spiral repeats its first step once, every style is in its cycle after one table length
+    for (int i=0;i<MAX_STEP_ORDER_SIZE;i++) old.next();
+    std::vector<int> indices(2*length);
+    for (int& index : indices) index = old.next();
+    for (int phase=0;phase<length;phase++)
+    {
+        bool same = true;
+        for (int i=0;i<2*length && same;i++) same = table.at((phase+i) % length) == indices[i];
+        if (same) return true;
+    }
+    return false;
+}
+
+int main()
+{
+    int failures = 0;
+    int compared = 0;
+    for (int style=styleForward;style<=styleStepUpDown;style++)
+    {
+        const int maxUp = style == styleStepUpDown ? MAX_SEQUENCER_STEPS_SIZE : 1;
+        for (int steps=1;steps<=MAX_NOTE_ON_GROUPS;steps++)
+        {
+            for (int stepsUp=1;stepsUp<=maxUp;stepsUp++)
+            {
+                for (int stepsDown=1;stepsDown<=maxUp;stepsDown++)
+                {
+                    compared += 1;
+                    if (sameCycle(style, steps, stepsUp, stepsDown)) continue;
+                    if (failures < 20)
+                        std::fprintf(stderr, "style %d, %d steps, up %d, down %d: the table differs from the old stepping\n",
+                                     style, steps, stepsUp, stepsDown);
+                    failures += 1;
+                }
+            }
+        }
+    }
+    std::printf("%d step orders compared, %d differ\n", compared, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+/*
+ * Plays a recorded pattern while the transposition, the style and the clock change in the
+ * middle of held chords, then releases every key: no note the plugin sent may stay on.
+ */
+
+#include "TestHost.h"
+#include <random>
+
+static const uint32_t BLOCK_SIZE = 256;
+
+static void recordPattern(TestHost& host)
+{
+    host.setParameter(bRecord, 1);
+    host.run(BLOCK_SIZE);
+    for (uint8_t group=0;group<4;group++)
+        host.run(BLOCK_SIZE, { midiEvent(1, 0x90, 60+group, 100), midiEvent(2, 0x90, 64+group, 100),
+                               midiEvent(10, 0x80, 60+group), midiEvent(11, 0x80, 64+group) });
+    host.setParameter(bRecord, 0);
+    host.run(BLOCK_SIZE);
+}
+
+static void changeParameter(TestHost& host, std::mt19937& random)
+{
+    switch (random() % 10)
+    {
+        case 0: host.setParameter(transposeSemi, int(random() % 25) - 12); break;
+        case 1: host.setParameter(transposeKey, random() % 3); break;
+        case 2: host.setParameter(transposeKeyBase, 36 + random() % 48); break;
+        case 3: host.setParameter(seqStyle, random() % styleCount); break;
+        case 4: host.setParameter(clockMode, random() % 2); break;
+        case 5: host.setParameter(scaleType, random() % scaleTypeCount); break;
+        case 6: host.setParameter(scaleRoot, random() % 12); break;
+        default: break;
+    }
+}
+
+/*
+ * One trial, returns the number of notes left sounding.
+ */
+static std::size_t trial(unsigned seed)
+{
+    std::mt19937 random(seed);
+    TestHost host;
+    host.activate();
+    host.timePosition().playing = true;
+    recordPattern(host);
+
+    std::set<uint8_t> held;
+    for (int block=0;block<400;block++)
+    {
+        std::vector<MidiEvent> events;
+        uint32_t frame = 0;
+        for (unsigned count=random() % 4;count>0;count--)
+        {
+            frame += random() % 10;
+            const uint8_t key = 48 + random() % 24;
+            if (held.erase(key))
+                events.push_back(midiEvent(frame, 0x80, key));
+            else
+            {
+                events.push_back(midiEvent(frame, 0x90, key, 100));
+                held.insert(key);
+            }
+        }
+        changeParameter(host, random);
+        host.run(BLOCK_SIZE, events);
+    }
+
+    std::vector<MidiEvent> releases;
+    for (uint8_t key : held) releases.push_back(midiEvent(0, 0x80, key));
+    host.setParameter(clockMode, clockKeys);
+    host.run(BLOCK_SIZE, releases);
+    host.idle(100 * BLOCK_SIZE, BLOCK_SIZE);
+    host.deactivate();
+
+    TEST_CHECK(host.hostErrors == 0);
+    TEST_CHECK(std::count_if(host.output.begin(), host.output.end(),
+                             [](const TimedEvent& event) { return (event.status & 0xF0) == 0x90; }) > 0);
+    SoundingNotes sounding;
+    sounding.add(host.output);
+    for (const std::pair<int, int>& note : sounding.all())
+        std::fprintf(stderr, "seed %u: channel %d note %d left on\n", seed, note.first + 1, note.second);
+    return sounding.size();
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned trials = argc > 1 ? unsigned(std::atoi(argv[1])) : 200;
+    std::size_t stuck = 0;
+    for (unsigned seed=1;seed<=trials;seed++) stuck += trial(seed);
+    std::printf("%u trials, %zu stuck notes\n", trials, stuck);
+    return stuck == 0 ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+#ifndef MIDI_PERFOSEQ_TEST_HOST_INCLUDED
+#define MIDI_PERFOSEQ_TEST_HOST_INCLUDED
+
+#include "DistrhoPlugin.hpp"
+#include "MidiPerfoSeq.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <utility>
+#include <vector>
+
+using DISTRHO::MidiEvent;
+
+/*
+ * An output event with its time counted from the first block.
+ */
+struct TimedEvent {
+    uint64_t time;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+};
+
+/*
+ * Plays the plugin host for a test: calls the plugin like DPF does, block after block,
+ * and keeps what run() writes with the time of its block. A block whose output isn't
+ * in frame order or leaves the block counts as a host error.
+ */
+class TestHost
+{
+public:
+    TestHost() : plugin(DISTRHO::createPlugin())
+    {
+        plugin->output = &blockOutput;
+        blockOutput.reserve(OUTPUT_CAPACITY);
+    }
+
+    ~TestHost() { delete plugin; }
+
+    TestHost(const TestHost&) = delete;
+    TestHost& operator=(const TestHost&) = delete;
+
+    void activate() { plugin->activate(); }
+    void deactivate() { plugin->deactivate(); }
+
+    void setParameter(uint32_t index, float value) { plugin->setParameterValue(index, value); }
+    float parameter(uint32_t index) const { return plugin->getParameterValue(index); }
+
+    DISTRHO::String state(const char* key) const { return plugin->getState(key); }
+    void setState(const char* key, const char* value) { plugin->setState(key, value); }
+
+    DISTRHO::TimePosition& timePosition() { return plugin->timePosition; }
+
+    // events the host takes per block, the rest of a block is refused
+    void limitOutput(std::size_t limit) { outputLimit = limit; }
+
+    /*
+     * Runs one block with events in frame order (frames relative to the block).
+     */
+    void run(uint32_t frames, const std::vector<MidiEvent>& events = std::vector<MidiEvent>())
+    {
+        blockOutput.clear();
+        plugin->outputLimit = std::min(outputLimit, std::size_t(OUTPUT_CAPACITY));
+        plugin->timePosition.frame = time;
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        plugin->run(nullptr, nullptr, frames, events.data(), uint32_t(events.size()));
+        runTime = std::chrono::steady_clock::now() - start;
+        uint32_t last = 0;
+        for (const MidiEvent& event : blockOutput)
+        {
+            if (event.frame < last || event.frame >= frames) hostErrors += 1;
+            last = event.frame;
+            const TimedEvent timed = { time + event.frame, event.data[0],
+                                       event.size > 1 ? event.data[1] : uint8_t(0),
+                                       event.size > 2 ? event.data[2] : uint8_t(0) };
+            output.push_back(timed);
+        }
+        time += frames;
+    }
+
+    // runs empty blocks until the given number of frames has passed
+    void idle(uint64_t frames, uint32_t blockSize = 256)
+    {
+        for (uint64_t done=0;done<frames;done+=blockSize) run(blockSize);
+    }
+
+    uint64_t time = 0;
+    std::vector<TimedEvent> output;
+    int hostErrors = 0;
+    std::chrono::nanoseconds runTime{0};  // what the last plugin run() took
+
+private:
+    static const int OUTPUT_CAPACITY = 1 << 16;
+
+    DISTRHO::Plugin* const plugin;
+    std::vector<MidiEvent> blockOutput;  // reserved, run() must not make it allocate
+    std::size_t outputLimit = OUTPUT_CAPACITY;
+};
+
+inline MidiEvent midiEvent(uint32_t frame, uint8_t status, uint8_t data1 = 0, uint8_t data2 = 0)
+{
+    MidiEvent event;
+    event.frame = frame;
+    event.size = status >= 0xF8 ? 1 : (status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0 ? 2 : 3;
+    event.data[0] = status;
+    event.data[1] = data1;
+    event.data[2] = data2;
+    event.data[3] = 0;
+    event.dataExt = nullptr;
+    return event;
+}
+
+/*
+ * The notes an output stream leaves sounding, by channel and pitch.
+ */
+class SoundingNotes
+{
+public:
+    void add(const TimedEvent& event)
+    {
+        const std::pair<int, int> note(event.status & 0x0F, event.data1);
+        if ((event.status & 0xF0) == 0x90 && event.data2 > 0)
+            notes.insert(note);
+        else if ((event.status & 0xF0) == 0x80 || (event.status & 0xF0) == 0x90)
+            notes.erase(note);
+    }
+
+    void add(const std::vector<TimedEvent>& events)
+    {
+        for (const TimedEvent& event : events) add(event);
+    }
+
+    bool empty() const { return notes.empty(); }
+    std::size_t size() const { return notes.size(); }
+    const std::set<std::pair<int, int>>& all() const { return notes; }
+
+private:
+    std::set<std::pair<int, int>> notes;
+};
+
+/*
+ * Test failures print where they happened and end the test with a failure.
+ */
+#define TEST_CHECK(condition) \
+    do { \
+        if (! (condition)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+#endif
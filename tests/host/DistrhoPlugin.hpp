@@ -0,0 +1,240 @@
+#ifndef MIDI_PERFOSEQ_TEST_DISTRHO_PLUGIN_INCLUDED
+#define MIDI_PERFOSEQ_TEST_DISTRHO_PLUGIN_INCLUDED
+
+/*
+ * Stand-in for the part of the DPF plugin API the plugin uses, so the tests and
+ * benchmarks build and run without the dpf submodule and without a plugin host.
+ * TestHost (TestHost.h) plays the host: it calls the plugin like DPF does and
+ * collects what run() writes.
+ */
+
+#include "DistrhoPluginInfo.h"
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define START_NAMESPACE_DISTRHO namespace DISTRHO {
+#define END_NAMESPACE_DISTRHO }
+#define USE_NAMESPACE_DISTRHO using namespace DISTRHO;
+#define DISTRHO_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ClassName) \
+    ClassName(const ClassName&) = delete; \
+    ClassName& operator=(const ClassName&) = delete;
+
+class TestHost;
+
+namespace DISTRHO {
+
+inline void d_stdout(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    std::vfprintf(stdout, fmt, args);
+    std::fputc('\n', stdout);
+    va_end(args);
+}
+
+inline void d_stderr(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    std::vfprintf(stderr, fmt, args);
+    std::fputc('\n', stderr);
+    va_end(args);
+}
+
+inline void d_msleep(unsigned int msecs)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(msecs));
+}
+
+constexpr uint32_t d_version(uint8_t major, uint8_t minor, uint8_t micro)
+{
+    return (uint32_t(major) << 16) | (uint32_t(minor) << 8) | micro;
+}
+
+static constexpr uint32_t kParameterIsAutomatable = 0x01;
+static constexpr uint32_t kParameterIsBoolean     = 0x02;
+static constexpr uint32_t kParameterIsInteger     = 0x04;
+static constexpr uint32_t kParameterIsLogarithmic = 0x08;
+static constexpr uint32_t kParameterIsOutput      = 0x10;
+static constexpr uint32_t kParameterIsTrigger     = 0x20 | kParameterIsBoolean;
+
+static constexpr uint32_t kStateIsFilenamePath = 0x01;
+static constexpr uint32_t kStateIsBase64Blob   = 0x02;
+static constexpr uint32_t kStateIsOnlyForDSP   = 0x04;
+
+class String
+{
+public:
+    String() {}
+    String(const char* text) : value(text != nullptr ? text : "") {}
+    explicit String(int number) : value(std::to_string(number)) {}
+
+    String operator+(const String& other) const { return String((value + other.value).c_str()); }
+    String& operator+=(const char* text) { value += text; return *this; }
+    bool operator==(const char* text) const { return value == text; }
+    operator const char*() const { return value.c_str(); }
+    const char* buffer() const { return value.c_str(); }
+    std::size_t length() const { return value.size(); }
+    bool isEmpty() const { return value.empty(); }
+    bool isNotEmpty() const { return ! value.empty(); }
+
+    static String asBase64(const void* data, std::size_t size)
+    {
+        static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        const uint8_t* const bytes = static_cast<const uint8_t*>(data);
+        String encoded;
+        for (std::size_t i=0;i<size;i+=3)
+        {
+            const uint32_t group = (uint32_t(bytes[i]) << 16)
+                                 | (i+1 < size ? uint32_t(bytes[i+1]) << 8 : 0)
+                                 | (i+2 < size ? uint32_t(bytes[i+2]) : 0);
+            encoded.value += digits[(group >> 18) & 63];
+            encoded.value += digits[(group >> 12) & 63];
+            encoded.value += i+1 < size ? digits[(group >> 6) & 63] : '=';
+            encoded.value += i+2 < size ? digits[group & 63] : '=';
+        }
+        return encoded;
+    }
+
+private:
+    std::string value;
+};
+
+struct ParameterRanges {
+    float def = 0.0f;
+    float min = 0.0f;
+    float max = 1.0f;
+};
+
+struct ParameterEnumerationValue {
+    float value = 0.0f;
+    String label;
+};
+
+struct ParameterEnumerationValues {
+    uint8_t count = 0;
+    bool restrictedMode = false;
+    ParameterEnumerationValue* values = nullptr;
+
+    ParameterEnumerationValues() {}
+    ~ParameterEnumerationValues() { delete[] values; }
+    ParameterEnumerationValues(const ParameterEnumerationValues&) = delete;
+    ParameterEnumerationValues& operator=(const ParameterEnumerationValues&) = delete;
+};
+
+struct Parameter {
+    uint32_t hints = 0;
+    String name;
+    String shortName;
+    String symbol;
+    String unit;
+    String description;
+    ParameterRanges ranges;
+    ParameterEnumerationValues enumValues;
+    uint32_t groupId = 0;
+};
+
+struct PortGroup {
+    String name;
+    String symbol;
+};
+
+struct State {
+    uint32_t hints = 0;
+    String key;
+    String defaultValue;
+    String label;
+    String description;
+};
+
+struct MidiEvent {
+    static constexpr uint32_t kDataSize = 4;
+    uint32_t frame;
+    uint32_t size;
+    uint8_t data[kDataSize];
+    const uint8_t* dataExt;
+};
+
+struct TimePosition {
+    bool playing = false;
+    uint64_t frame = 0;
+    struct BarBeatTick {
+        bool valid = false;
+        int32_t bar = 1;
+        int32_t beat = 1;
+        double tick = 0.0;
+        double barStartTick = 0.0;
+        float beatsPerBar = 4.0f;
+        float beatType = 4.0f;
+        double ticksPerBeat = 1920.0;
+        double beatsPerMinute = 120.0;
+    } bbt;
+};
+
+class Plugin
+{
+public:
+    Plugin(uint32_t parameterCount, uint32_t programCount, uint32_t stateCount)
+        : parameters(parameterCount), states(stateCount)
+    {
+        (void)programCount;
+    }
+    virtual ~Plugin() {}
+
+    double getSampleRate() const noexcept { return sampleRate; }
+    const TimePosition& getTimePosition() const noexcept { return timePosition; }
+
+    // false when the host buffer is full, like the DPF wrappers do
+    bool writeMidiEvent(const MidiEvent& event) noexcept
+    {
+        if (output == nullptr || output->size() >= outputLimit) return false;
+        output->push_back(event);
+        return true;
+    }
+
+protected:
+    virtual const char* getLabel() const = 0;
+    virtual const char* getDescription() const { return ""; }
+    virtual const char* getMaker() const = 0;
+    virtual const char* getHomePage() const { return ""; }
+    virtual const char* getLicense() const = 0;
+    virtual uint32_t getVersion() const = 0;
+    virtual int64_t getUniqueId() const { return 0; }
+    virtual void initPortGroup(uint32_t, PortGroup&) {}
+    virtual void initParameter(uint32_t, Parameter&) {}
+    virtual void initState(uint32_t, State&) {}
+    virtual float getParameterValue(uint32_t) const { return 0.0f; }
+    virtual void setParameterValue(uint32_t, float) {}
+    virtual String getState(const char*) const { return String(); }
+    virtual void setState(const char*, const char*) {}
+    virtual void activate() {}
+    virtual void deactivate() {}
+    virtual void run(const float** inputs, float** outputs, uint32_t frames,
+                     const MidiEvent* midiEvents, uint32_t midiEventCount) = 0;
+    virtual void sampleRateChanged(double) {}
+
+private:
+    friend class ::TestHost;
+
+    uint32_t parameters;
+    uint32_t states;
+    double sampleRate = 48000.0;
+    TimePosition timePosition;
+    std::vector<MidiEvent>* output = nullptr;
+    std::size_t outputLimit = 0;
+};
+
+Plugin* createPlugin();
+
+}
+
+// like DPF, plugin sources see the DISTRHO names unqualified
+using namespace DISTRHO;
+
+#endif
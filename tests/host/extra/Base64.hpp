@@ -0,0 +1,33 @@
+#ifndef MIDI_PERFOSEQ_TEST_BASE64_INCLUDED
+#define MIDI_PERFOSEQ_TEST_BASE64_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+ * Decoder matching String::asBase64() of the DPF stand-in, characters outside
+ * the alphabet are skipped.
+ */
+inline std::vector<uint8_t> d_getChunkFromBase64String(const char* text)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::vector<uint8_t> data;
+    uint32_t group = 0;
+    int bits = 0;
+    for (const char* c = text; *c != '\0' && *c != '='; c++)
+    {
+        const char* const digit = std::strchr(digits, *c);
+        if (digit == nullptr) continue;
+        group = (group << 6) | uint32_t(digit - digits);
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            data.push_back(uint8_t(group >> bits));
+        }
+    }
+    return data;
+}
+
+#endif